@@ -314,6 +314,54 @@ namespace Quants_DSL{
 			return std::get<5>(i);
 		};
 
+	// Compiles a (sub)program of the QuantsGrammar
+	// into a compiled meaning over ArgL, ArgR and QApply.
+	// Returns nullptr for programs that cannot be compiled,
+	// e.g. if they contain nTh.
+	t_cnode compileProgram(const ProgramNode& p) {
+
+		static const std::map<std::string, CMOp> ops = {
+			{"( union %s %s )"			, CMOp::Union},
+			{"( intersection %s %s )"	, CMOp::Intersection},
+			{"( setminus %s %s )"		, CMOp::Setminus},
+			{"( intEq %s %s )"			, CMOp::IntEq},
+			{"( intGt %s %s )"			, CMOp::IntGt},
+			{"( not %s )"				, CMOp::Not},
+			{"( and %s %s )"			, CMOp::And},
+			{"( or %s %s )"				, CMOp::Or},
+			{"( + %s %s )"				, CMOp::Plus},
+			{"( - %s %s )"				, CMOp::Minus}
+		};
+
+		const std::string& f = p.format;
+		if (f == "%s.L") return cnode(CMOp::ArgL);
+		if (f == "%s.R") return cnode(CMOp::ArgR);
+		if (f == "( universe %s )") return cnode(CMOp::Universe);
+		if (f == "0" || f == "1") return cnode(CMOp::Const, {}, std::stoi(f));
+
+		if (f == "( cardinality %s %s )") {
+			t_cnode set = compileProgram(p.kids[0]);
+			return set ? cnode(CMOp::Card, {set}) : nullptr;
+		}
+
+		// [[X.Q IV] IV]: the only way to build a DP
+		if (f == "( %s %s )" && p.kids[0].format == "( %s %s )" &&
+				p.kids[0].kids[0].format == "%s.Q") {
+			t_cnode l = compileProgram(p.kids[0].kids[1]);
+			t_cnode r = compileProgram(p.kids[1]);
+			return l && r ? cnode(CMOp::QApply, {l, r}) : nullptr;
+		}
+
+		auto op = ops.find(f);
+		if (op == ops.end()) return nullptr;
+		std::vector<t_cnode> kids;
+		for (auto& k : p.kids) {
+			kids.push_back(compileProgram(k));
+			if (!kids.back()) return nullptr;
+		}
+		return cnode(op->second, kids);
+	}
+
 	/////// NOT IN VAN DE POL ///////
 
 	/* 	auto complement = */ 
@@ -517,8 +565,36 @@ private:
 	// Maximum depth of signals when enumerating utterances
 	// to estimate communicative accuracy
 	static inline size_t searchDepth = 2;
+	// A slice of the context pool is refreshed every poolRefresh
+	// likelihood evaluations (0 never refreshes it)
+	static inline size_t poolRefresh = 10;
+	// Number of contexts in a slice (0 is a tenth of the pool)
+	static inline size_t poolSlice = 0;
+	// local_rng is shared by the threads that create pools
+	static inline std::mutex poolMutex;
+	// Contexts per batch of the sequential estimate of
+	// communicative accuracy (0 is all at once)
+	static inline size_t stopBatch = 0;
+	// It stops when the standard error of the likelihood
+	// is below this (0 never stops early for this reason)
+	static inline double stopTolerance = 0;
+	// Likelihood evaluations and the contexts they used,
+	// over the whole run
+	static inline std::atomic<size_t> nEvaluations = 0;
+	static inline std::atomic<size_t> nContextsUsed = 0;
 	// For storing
 	data_t commData;
+	// contexts used by the last likelihood evaluation
+	size_t contextsUsed = 0;
+	// communicative accuracy of the last likelihood evaluation
+	// (NaN if it stopped at breakout)
+	double commAcc = 0;
+
+	void recordContextsUsed(size_t n) {
+		contextsUsed = n;
+		nEvaluations++;
+		nContextsUsed += n;
+	}
 
 public:
 	using Super = DeterministicLOTHypothesis<
@@ -531,6 +607,11 @@ public:
 
 	using Super::Super; 
 
+	// The meanings of the grammar only look at the features of the
+	// entities, not at their order, so the listener can count them
+	// (see Agent::listen). Remove this if nTh is added back
+	static constexpr bool permutationInvariant = true;
+
 	static void setParams(size_t nObs, 
 						  size_t cSize,
 						  double likelihoodWeight,
@@ -544,6 +625,75 @@ public:
 		QuantsHypothesis::searchDepth = searchDepth;
 	}
 
+	static void setContextPool(size_t refresh, size_t slice) {
+		QuantsHypothesis::poolRefresh = refresh;
+		QuantsHypothesis::poolSlice = slice;
+	}
+
+	static void setStoppingRule(size_t batch, double tolerance) {
+		QuantsHypothesis::stopBatch = batch;
+		QuantsHypothesis::stopTolerance = tolerance;
+	}
+
+	// Average contexts per likelihood evaluation so far
+	static double meanContextsUsed() {
+		size_t n = nEvaluations;
+		return n > 0 ? double(nContextsUsed) / n : 0.0;
+	}
+
+	// A new context pool with the current parameters
+	static ContextPool makeContextPool(uint64_t seed) {
+		return ContextPool(
+			cSize,
+			nObs,
+			seed,
+			poolRefresh,
+			poolSlice > 0 ? poolSlice : nObs/10
+		);
+	}
+
+	// Fleet draws proposals from its thread-local generator.
+	// Chains that move between threads (see speculative.h) seed it
+	// from their own generator before each proposal, so that 
+	// they can be checkpointed and resumed exactly
+	static void seedProposals(uint64_t seed) {
+		rng.seed(seed);
+	}
+
+	// The context pool of this thread, for Fleet's chains.
+	// Fleet does not pin chains to threads, so this is not a pool
+	// per chain: with fewer --threads than --chains, the chains that
+	// take turns on a thread share its pool and all advance it.
+	// The hypotheses evaluated in a row on a thread still see the same
+	// contexts, which is what common random numbers need.
+	// The chains of this project own their pool (see speculative.h)
+	static ContextPool& contextPool() {
+		static thread_local std::optional<ContextPool> pool;
+		if (!pool || pool->size() != nObs || pool->contextSize() != cSize) {
+			uint64_t seed;
+			{
+				std::lock_guard lock(poolMutex);
+				seed = local_rng();
+			}
+			pool.emplace(makeContextPool(seed));
+		}
+		return *pool;
+	}
+
+	// With probability componentProposals, a proposal changes
+	// only one of the four parts (see proposals.h)
+	std::optional<std::pair<QuantsHypothesis, double>> propose() const override {
+		if (componentProposals <= 0 ||
+				std::uniform_real_distribution<double>(0.0, 1.0)(rng) >= componentProposals) {
+			return Super::propose();
+		}
+		static const ComponentProposal<QuantsGrammar> kernel(
+			grammar, grammar.GRAMMAR_MAX_DEPTH);
+		auto p = kernel.propose(this->serialize(), rng);
+		if (!p) return std::nullopt;
+		return std::make_pair(QuantsHypothesis(p->first), p->second);
+	}
+
 	QuantsHypothesis() : Super () {
 		// Maximum depth of the hypotheses
 		grammar.GRAMMAR_MAX_DEPTH = 50;
@@ -553,28 +703,138 @@ public:
 		return commData;
 	}
 
+	void setCommData(const data_t& data) {
+		commData = data;
+	}
+
+	double getCommAcc() const {
+		return commAcc;
+	}
+
+	void setCommAcc(double value) {
+		commAcc = value;
+	}
+
+	size_t getContextsUsed() const {
+		return contextsUsed;
+	}
+
 	double compute_likelihood(const data_t& x,
 							  const double breakout=-infinity) override {
 		// NOTE: Here I disregard the data,
 		// since the likelihood only depends on communicative accuracy
 		// which I calculate inside this function.
+
+		// The contexts come from the pool of this chain,
+		// so that nearby hypotheses are compared on the same data
+		double loglik = likelihoodOn(contextPool().next(), breakout);
+		// every hypothesis any chain looks at is a candidate
+		// for the frontier of the tradeoff, not just the samples
+		paretoFrontier.add(this->compute_prior(), commAcc, *this);
+		return loglik;
+	}
+
+	// Communicative accuracy and data by what the agent can see
+	// of a hypothesis on some contexts (see structuralKey)
+	static SharedCache<std::pair<double, data_t>>& structuralCache() {
+		static SharedCache<std::pair<double, data_t>> cache(1 << 12);
+		return cache;
+	}
+
+	// What the agent can see of this hypothesis on these contexts,
+	// or nothing if its meanings cannot be compiled
+	std::optional<std::string> structuralKey(const std::vector<PooledContext>& cs) {
+		auto sem = compileSemantics();
+		if (!sem) return std::nullopt;
+		return behaviourKey(*sem) + "#" + std::to_string(searchDepth)
+			+ "#" + contextsKey(cs);
+	}
+
+	// The likelihood on given contexts. Unlike compute_likelihood,
+	// it does not touch the pool of the thread, so it can run 
+	// on any thread (e.g. for speculative proposals, see speculative.h)
+	double likelihoodOn(
+			const std::vector<PooledContext>& cs,
+			const double breakout=-infinity
+		) {
 		
+		// Hypotheses the agent cannot tell apart from one
+		// already evaluated on these contexts (see precheck.h)
+		// do not need the agent at all
+		std::optional<std::string> key = structuralKey(cs);
+		if (key) {
+			if (auto hit = structuralCache().find(*key)) {
+				commData = hit->second;
+				commAcc = hit->first;
+				recordContextsUsed(cs.size());
+				return likelihoodWeight * commAcc;
+			}
+		}
+
 		// Agent to calculate communicative accuracy with
 		// initialized with current hypothesis
 		Agent<QuantsHypothesis> agent{*this};
 
-		std::vector<t_context> cs = generateContexts(
-			cSize, nObs, local_rng);
-
-		// produce data for approximating communicative accuracy
+		// The contexts are consumed in batches of stopBatch
+		// (all at once by default), and the estimate stops early
+		// 1. when it cannot beat breakout anymore:
+		//    every context adds a log probability (<= 0),
+		//    so the contexts left can only lower the total, or
+		// 2. when its standard error is below stopTolerance.
+		// The first is exact, the second is an approximation.
+		size_t batchSize = stopBatch > 0 ? stopBatch : cs.size();
+		double cumCA = 0;
+		double cumSquares = 0;
+		size_t used = 0;
 		// NOTE: the data is assigned to the class variable commData
 		// so that it can be accessed in the sampling loop for storage
-		commData = agent.produceDataFromEnumeration(
-			cs, local_rng, searchDepth);
-		/* commData = agent.produceData(cs, local_rng, searchDepth); */
+		commData.clear();
+		while (used < cs.size()) {
+			std::vector<PooledContext> slice;
+			if (batchSize < cs.size()) {
+				slice.assign(
+					cs.begin() + used, 
+					cs.begin() + std::min(used + batchSize, cs.size())
+				);
+			}
+			const std::vector<PooledContext>& batch = 
+				batchSize < cs.size() ? slice : cs;
+
+			// produce data for approximating communicative accuracy
+			data_t data = agent.produceDataFromEnumeration(batch, searchDepth);
+			/* commData = agent.produceData(cs, local_rng, searchDepth); */
+			// the new agent computes its communicative accuracy
+			for (double CA : agent.contextAccuracies(data, batch)) {
+				cumCA += CA;
+				cumSquares += CA*CA;
+			}
+			commData.insert(commData.end(), data.begin(), data.end());
+			used += batch.size();
+			if (used == cs.size()) break;
+
+			// The best it can still do is 0 in every context left
+			double best = likelihoodWeight * cumCA / cs.size();
+			if (likelihoodWeight >= 0 && best < breakout) {
+				recordContextsUsed(used);
+				commAcc = std::nan("");
+				return best;
+			}
+			if (stopTolerance > 0 && used >= 2*batchSize) {
+				double mean = cumCA / used;
+				double variance = std::max(
+					(cumSquares - used*mean*mean) / (used - 1), 0.0);
+				double stderror = 
+					std::abs(likelihoodWeight) * std::sqrt(variance / used);
+				if (stderror < stopTolerance) break;
+			}
+		}
+		recordContextsUsed(used);
 
-		// the new agent computes its communicative accuracy
-		double commAcc = agent.communicativeAccuracy(commData, local_rng);
+		// average surprisal of an observation
+		commAcc = cumCA / used;
+		if (key && used == cs.size()) {
+			structuralCache().insert(*key, {commAcc, commData});
+		}
 
 		// The likelihood is the weighted sum of the communicative accuracy
 		// and the simplicity of the language.
@@ -593,6 +853,62 @@ public:
 		/* } */
 	}
 
+	// The likelihoods of several hypotheses on the same contexts,
+	// evaluated together (see Agent::evaluateBatch).
+	// Same as likelihoodOn on each of them, except that every
+	// hypothesis uses all the contexts: there is no breakout
+	// and no stopping rule, since the batch is one pass
+	static std::vector<double> likelihoodsOn(
+			std::vector<QuantsHypothesis>& hs,
+			const std::vector<PooledContext>& cs
+		) {
+		// the ones the structural cache does not know
+		std::vector<std::optional<std::string>> keys;
+		std::vector<size_t> missing;
+		std::vector<QuantsHypothesis> batch;
+		for (size_t i = 0; i < hs.size(); i++) {
+			keys.push_back(hs[i].structuralKey(cs));
+			auto hit = keys[i] ? structuralCache().find(*keys[i]) : std::nullopt;
+			if (hit) {
+				hs[i].commData = hit->second;
+				hs[i].commAcc = hit->first;
+				continue;
+			}
+			missing.push_back(i);
+			batch.push_back(hs[i]);
+		}
+		auto results = Agent<QuantsHypothesis>::evaluateBatch(batch, cs, searchDepth);
+		for (size_t j = 0; j < missing.size(); j++) {
+			QuantsHypothesis& h = hs[missing[j]];
+			h.commData = std::move(results[j].data);
+			h.commAcc = results[j].commAcc;
+			if (keys[missing[j]]) {
+				structuralCache().insert(*keys[missing[j]], {h.commAcc, h.commData});
+			}
+		}
+		std::vector<double> logliks;
+		for (auto& h : hs) {
+			h.recordContextsUsed(cs.size());
+			logliks.push_back(likelihoodWeight * h.commAcc);
+		}
+		return logliks;
+	}
+
+	// Communicative accuracies on the reference contexts of the
+	// frontier (see pareto.h). These are not likelihoods of a chain,
+	// so unlike likelihoodsOn they are not counted as contexts used,
+	// and do not go through the structural cache
+	static std::vector<double> referenceCommAccs(
+			std::vector<QuantsHypothesis>& hs,
+			const std::vector<PooledContext>& cs
+		) {
+		std::vector<double> commAccs;
+		for (auto& e : Agent<QuantsHypothesis>::evaluateBatch(hs, cs, searchDepth)) {
+			commAccs.push_back(e.commAcc);
+		}
+		return commAccs;
+	}
+
 	// Extracts the component of a sentence from the LOT 
 	// that encodes the composition function.
 	t_BTC_compose getCompositionF() {
@@ -722,6 +1038,48 @@ public:
 		});
 	}
 
+	// The program with its parts in canonical form (see simplify.h).
+	// Hypotheses with the same canonical program have the same
+	// likelihood, but not the same prior
+	std::string canonicalKey() const {
+		return canonicalProgram(this->serialize());
+	}
+
+	// The composition rule and the three quantifiers
+	// as compiled meanings, so that the agent can evaluate
+	// sentences without calling the hypothesis
+	// Each part is compiled once for all the hypotheses that have it,
+	// e.g. the three parts a proposal leaves alone (see proposals.h),
+	// or any way of writing it with the same canonical form,
+	// which is what gets compiled (see simplify.h)
+	std::optional<CompiledSemantics> compileSemantics() {
+		static SharedCache<t_cnode> compiledParts(1 << 16);
+		auto compilePart = [](const ProgramNode& part) {
+			ProgramNode simple = simplifyProgram(part);
+			std::string key = serializeProgram(simple);
+			if (auto hit = compiledParts.find(key)) return *hit;
+			t_cnode compiled = Quants_DSL::compileProgram(simple);
+			compiledParts.insert(key, compiled);
+			return compiled;
+		};
+		CompiledSemantics sem;
+		// The lexicon has no quantifiers apart from Q1, Q2, Q3
+		sem.quantifiers.clear();
+		try {
+			ProgramNode program = parseSerializedProgram(this->serialize());
+			sem.compRule = compilePart(program.kids.at(0));
+			if (!sem.compRule) return std::nullopt;
+			for (size_t i = 1; i <= 3; i++) {
+				t_cnode q = compilePart(program.kids.at(i));
+				if (!q) return std::nullopt;
+				sem.quantifiers["Q" + std::to_string(i)] = q;
+			}
+		} catch (std::exception& e) {
+			return std::nullopt;
+		}
+		return sem;
+	}
+
 	LexicalSemantics getLexicon() {
 		// the booleans are specifying which groups of words to include 
 		// in the lexicon, by their type.
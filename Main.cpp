@@ -16,6 +16,23 @@
 #include <bitset>
 #include <exception>
 #include <cassert>
+#include <bit>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <deque>
+#include <condition_variable>
+#include <unordered_map>
+#include <numeric>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <csignal>
 
 // Fleet stuff
 #include "Functional.h"
@@ -36,12 +53,51 @@
 #include "objects/language.h"
 // The world that produces the context
 #include "objects/world.h"
+// Compiled meanings and their lane-parallel evaluation
+#include "objects/compiled.h"
+#include "objects/lanes.h"
+// Batched kernels for the speaker and the listener
+#include "objects/kernels.h"
+// Runtime selection of the instruction set of the kernels
+#include "objects/dispatch.h"
+// Gray-code incremental evaluation over target variations
+#include "objects/graycode.h"
+// Exact counting listener for large contexts
+#include "objects/counting.h"
+// Monte Carlo listener for when nothing exact is affordable
+#include "objects/montecarlo.h"
+// Canonical contexts and caches shared by the run
+#include "objects/symmetry.h"
+// Precomputed truth of hypothesis-independent sentences
+#include "objects/atlas.h"
+// Checkpoints of long runs
+#include "objects/checkpoint.h"
+// Pool of contexts shared by nearby likelihood evaluations
+#include "objects/contextPool.h"
+// Threads for the work inside a single likelihood
+#include "objects/taskPool.h"
+// Frontier of the tradeoff, updated by all chains
+#include "objects/pareto.h"
 // The agents that produce, interpret, and learn
 #include "objects/agent.h"
+// Proposals that change one part of a hypothesis
+#include "objects/proposals.h"
+// What the agent can see of a hypothesis, before running it
+#include "objects/precheck.h"
+// Canonical forms of the parts of a hypothesis
+#include "objects/simplify.h"
 // Grammar and Hypothesis for the parts of language to infer
 // INCLUDE ONLY THE ONE YOU NEED
 /* #include "LoTs/LoTCompFunc.h" */
 #include "LoTs/LoTQuantifiers.h"
+// Speculative MH chains
+#include "objects/speculative.h"
+// Sequential Monte Carlo over the likelihood weight
+#include "objects/smc.h"
+// Exhaustive enumeration of the hypotheses
+#include "objects/enumeration.h"
+// Starting points from previous runs
+#include "objects/warmStart.h"
 // Implementation of the tradeoff analysis
 #include "objects/Tradeoff.h"
 #include "objects/CommAcc.h"
@@ -73,6 +129,21 @@ int main(int argc, char** argv) {
 	double likelihoodWeight = 1;
 	double searchDepth 		= 2;
 	std::string fname 		= "./data/tradeoff/";
+	std::string isa 		= "auto";
+	std::string listener 	= "auto";
+	std::string atlas 		= "";
+	std::string buildAtlas 	= "";
+	size_t poolRefresh 		= 10;
+	size_t poolSlice 		= 0;
+	int likThreads 			= 0;
+	size_t stopBatch 		= 0;
+	std::string weights 	= "";
+	bool checkpoints 		= false;
+	double frontierEvery 	= 600;
+	double stopTolerance 	= 0;
+	std::string warmStartFile = "";
+	size_t enumerateSize 	= 0;
+	double enumeratePrior 	= 0;
 
 	fleet.add_option<size_t>(
 		"--nobs",
@@ -100,9 +171,201 @@ int main(int argc, char** argv) {
 		"Folder name for saving runs"
 	);
 	
+	fleet.add_option<std::string>(
+		"--isa",
+		isa,
+		"Instruction set of the kernels: auto, generic, avx2 or avx512"
+	);
+	
+	fleet.add_option<std::string>(
+		"--listener",
+		listener,
+		"How the listener goes through target variations: auto, enumerate, counts or montecarlo"
+	);
+	fleet.add_option<size_t>(
+		"--mcsamples",
+		defaultMonteCarlo.budget,
+		"Maximum number of sampled target variations per sentence for the montecarlo listener"
+	);
+	fleet.add_option<double>(
+		"--mcerror",
+		defaultMonteCarlo.maxError,
+		"Target half-width of the 95% interval of the informativity for the montecarlo listener"
+	);
+	
+	fleet.add_option<std::string>(
+		"--atlas",
+		atlas,
+		"Truth atlas to map at startup (built with --buildatlas for the same --csize)"
+	);
+	fleet.add_option<std::string>(
+		"--buildatlas",
+		buildAtlas,
+		"Write the truth atlas for --csize and --searchdepth to this file and exit"
+	);
+	
+	fleet.add_option<size_t>(
+		"--poolrefresh",
+		poolRefresh,
+		"Refresh a slice of the context pool every this many likelihood evaluations (0: never)"
+	);
+	fleet.add_option<size_t>(
+		"--poolslice",
+		poolSlice,
+		"Contexts refreshed at a time in the context pool (0: a tenth of --nobs)"
+	);
+	
+	fleet.add_option<int>(
+		"--likthreads",
+		likThreads,
+		"Worker threads that run the likelihoods' work for all chains (0: none, or the cores not used by chains with --speculative, -1: the cores not used by chains)"
+	);
+	
+	fleet.add_option<size_t>(
+		"--speculative",
+		speculativeWidth,
+		"Run --chains speculative MH chains evaluating this many proposals at a time on the --likthreads workers, instead of parallel tempering (0: off)"
+	);
+	
+	fleet.add_option<size_t>(
+		"--screen",
+		screenSize,
+		"Screen proposals with the likelihood on this many fixed contexts before the full one (delayed acceptance; 0: off)"
+	);
+	
+	fleet.add_option<size_t>(
+		"--stopbatch",
+		stopBatch,
+		"Estimate communicative accuracy in batches of this many contexts, stopping early when possible (0: all at once)"
+	);
+	fleet.add_option<double>(
+		"--stoptolerance",
+		stopTolerance,
+		"Stop the estimate when the standard error of the likelihood is below this (0: never)"
+	);
+	
+	fleet.add_option<double>(
+		"--componentprob",
+		componentProposals,
+		"Probability that a proposal regenerates a subtree of only one of the four parts of the hypothesis (0: always Fleet's proposal)"
+	);
+	
+	fleet.add_option<size_t>(
+		"--evalbatch",
+		evaluationBatch,
+		"Hypotheses on the same contexts evaluated together, sharing sentences and listener results (0: one batch per thread)"
+	);
+	
+	fleet.add_option<std::string>(
+		"--weights",
+		weights,
+		"Comma-separated likelihood weights to run at once with replica exchange (overrides --likelihoodweight)"
+	);
+	fleet.add_option<size_t>(
+		"--swapevery",
+		roundSteps,
+		"Steps between replica exchanges across weights, and between checkpoints"
+	);
+	
+	fleet.add_option<double>(
+		"--frontierevery",
+		frontierEvery,
+		"Seconds between writes of frontier.csv during the run (0: only at the end)"
+	);
+	fleet.add_option<bool>(
+		"--fulldump",
+		writeFullDump,
+		"Write every sample to hyp.csv and data.txt"
+	);
+	
+	fleet.add_option<bool>(
+		"--checkpoint",
+		checkpoints,
+		"Write checkpoints to the run folder (on SIGTERM/SIGUSR1, and every --checkpointevery seconds)"
+	);
+	fleet.add_option<double>(
+		"--checkpointevery",
+		checkpointEvery,
+		"Seconds between checkpoints (0: only on signals)"
+	);
+	fleet.add_option<bool>(
+		"--resume",
+		resumeRun,
+		"Continue the run from the checkpoint in the run folder"
+	);
+	
+	fleet.add_option<std::string>(
+		"--warmstart",
+		warmStartFile,
+		"Start the chains from the best hypotheses in this hyp.csv, or the best frontier points at each weight in this frontier.csv"
+	);
+	fleet.add_option<size_t>(
+		"--warmtop",
+		warmStart.top,
+		"Distinct warm starts shared out among the chains (0: one per chain)"
+	);
+	
+	fleet.add_option<size_t>(
+		"--enumeratesize",
+		enumerateSize,
+		"Enumerate every hypothesis whose four parts have at most this many nodes, instead of sampling (0: no bound)"
+	);
+	fleet.add_option<double>(
+		"--enumerateprior",
+		enumeratePrior,
+		"Enumerate every hypothesis with at least this (negative) log prior, instead of sampling (0: no bound)"
+	);
+	
+	fleet.add_option<size_t>(
+		"--smcparticles",
+		smcParticles,
+		"Run Sequential Monte Carlo from the prior to --likelihoodweight with this many particles, instead of MCMC (0: off)"
+	);
+	fleet.add_option<size_t>(
+		"--smcsteps",
+		smcSteps,
+		"MH steps of each particle per generation of Sequential Monte Carlo"
+	);
+	fleet.add_option<double>(
+		"--smcess",
+		smcESS,
+		"Effective sample size kept between generations of Sequential Monte Carlo, as a fraction of the particles"
+	);
+	
 	// Note that Fleet uses CLI11, so you can add your own options
 	fleet.initialize(argc, argv);
 
+	setKernelISA(isa);
+	std::cout << "Kernels: " << activeKernels.name << std::endl;
+	setListenerMode(listener);
+	QuantsHypothesis::setContextPool(poolRefresh, poolSlice);
+	QuantsHypothesis::setStoppingRule(stopBatch, stopTolerance);
+	if (likThreads < 0) {
+		// the chains take --threads cores, and work with the pool
+		size_t cores = std::thread::hardware_concurrency();
+		likThreads = cores > FleetArgs::nthreads ? cores - FleetArgs::nthreads : 0;
+	} else if (likThreads == 0 && speculativeWidth > 1) {
+		// the proposals of a speculative round are evaluated on the pool,
+		// so without workers they would be evaluated one after the other.
+		// Each of the --chains chains runs on its own thread and
+		// evaluates one of its proposals itself
+		size_t cores = std::thread::hardware_concurrency();
+		size_t chains = std::max(size_t{FleetArgs::nchains}, size_t(1));
+		size_t spare = cores > chains ? cores - chains : 1;
+		likThreads = std::min(spare, chains * (speculativeWidth - 1));
+	}
+	taskPool.resize(likThreads);
+
+	if (!buildAtlas.empty()) {
+		buildTruthAtlas<QuantsHypothesis>(
+			buildAtlas, cSize, searchDepth, QuantsHypothesis::sample());
+		return 0;
+	}
+	if (!atlas.empty()) {
+		truthAtlas.load(atlas, cSize);
+		std::cout << "Atlas: " << truthAtlas.nSentences() << " sentences" << std::endl;
+	}
+
 	// Since we use TopN as a finite approximation
 	FleetArgs::MCMCYieldOnlyChanges = true;
 
@@ -246,12 +509,87 @@ int main(int argc, char** argv) {
 			j["likelihoodweight"] = likelihoodWeight;
 			j["searchdepth"] = searchDepth;
 			j["steps"] = FleetArgs::steps;
+			j["weights"] = weights;
+			j["warmstart"] = warmStartFile;
+			j["enumeratesize"] = enumerateSize;
+			j["enumerateprior"] = enumeratePrior;
+			j["smcparticles"] = smcParticles;
 			jfile << j.dump() << std::endl;
 
+			paretoFrontier.open(dir / "frontier.csv", frontierEvery, rng());
+			if (checkpoints || resumeRun) {
+				// only the sampling runs look for the signals
+				// and can be saved
+				if (weights.empty() && 
+						(enumerateSize > 0 || enumeratePrior < 0 || smcParticles > 0)) {
+					std::cerr 
+						<< "Checkpoints are not supported with --enumeratesize, "
+						<< "--enumerateprior or --smcparticles" 
+						<< std::endl;
+					return 1;
+				}
+				checkpointPath = dir / "checkpoint";
+				installCheckpointSignals();
+			}
+			if (!warmStartFile.empty() && !resumeRun) {
+				warmStart.load<QuantsHypothesis>(warmStartFile);
+			}
+
+			if (!weights.empty()) {
+				std::vector<double> sweep;
+				std::stringstream ss(weights);
+				std::string w;
+				while (std::getline(ss, w, ',')) {
+					sweep.push_back(std::stod(w));
+				}
+				runTradeoffSweep<QuantsHypothesis>(
+					nObs,
+					cSize,
+					sweep,
+					rng,
+					searchDepth,
+					dir
+				);
+				break;
+			}
+
 			std::filesystem::path datafilepath = dir / "data.txt";
 			std::filesystem::path hypfilepath = dir / "hyp.csv";
 
-			initializeHypCSV(hypfilepath);
+			if (!resumeRun) initializeHypCSV(hypfilepath);
+
+			// a log prior bound above 0 would leave nothing to enumerate
+			if (enumeratePrior > 0) {
+				throw std::runtime_error("--enumerateprior is a log prior and must be negative");
+			}
+			if (enumerateSize > 0 || enumeratePrior < 0) {
+				runTradeoffEnumeration<QuantsHypothesis>(
+					nObs,
+					cSize,
+					likelihoodWeight,
+					rng,
+					searchDepth,
+					enumerateSize,
+					enumeratePrior,
+					datafilepath,
+					hypfilepath
+				);
+				break;
+			}
+
+			if (smcParticles > 0) {
+				runTradeoffSMC<QuantsHypothesis>(
+					nObs,
+					cSize,
+					likelihoodWeight,
+					rng,
+					searchDepth,
+					dir,
+					datafilepath,
+					hypfilepath
+				);
+				break;
+			}
 
 			/* TopN<QuantsHypothesis> results = */ 
 			runTradeoffAnalysis<QuantsHypothesis>(
@@ -282,4 +620,8 @@ int main(int argc, char** argv) {
 			break;
 		}
 	}
+
+	if (!monteCarloSummary.empty()) {
+		monteCarloSummary.report(std::cout, defaultMonteCarlo.z);
+	}
 }
@@ -36,10 +36,14 @@ void estimateCommAcc(
 	int nruns = 10;
 	for (int i = 0; i < nruns; i++) {
 
-		std::vector<t_context> cs = generateContexts(cSize, nObs, rng, 0.25);
-		typename Hyp::data_t commData = agent.produceDataFromEnumeration(
-				cs, rng, searchDepth);
-		double commAcc = agent.communicativeAccuracy(commData, rng);
+		// the speaker's choice in each context has its own seed,
+		// as in the context pools of the tradeoff
+		std::vector<PooledContext> cs;
+		for (auto& c : generateContexts(cSize, nObs, rng, 0.25)) {
+			cs.push_back(poolContext(c, rng()));
+		}
+		double commAcc = Agent<Hyp>::evaluateBatch(
+			{agent.getHypothesis()}, cs, searchDepth)[0].commAcc;
 		double loglik = likelihoodWeight * commAcc;
 		logliks.push_back(loglik);
 		printProgress(static_cast<double>(i)/nruns);
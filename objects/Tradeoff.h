@@ -1,6 +1,46 @@
 # pragma once
 # include <typeinfo>
 
+// Whether every sample goes to hyp.csv and data.txt.
+// The tradeoff itself is in frontier.csv either way (see pareto.h)
+bool writeFullDump = true;
+
+// The TopN in checkpoints (see checkpoint.h)
+template <typename LangHyp>
+void saveTop(std::ostream& os, TopN<LangHyp>& top) {
+	auto values = top.values();
+	writeValue(os, uint64_t(values.size()));
+	for (auto& h : values) {
+		writeValue(os, h.serialize());
+		writeValue(os, h.prior);
+		writeValue(os, h.likelihood);
+		writeValue(os, h.posterior);
+	}
+}
+
+template <typename LangHyp>
+void loadTop(std::istream& is, TopN<LangHyp>& top) {
+	size_t n = readSize(is);
+	for (size_t k = 0; k < n; k++) {
+		LangHyp h(readString(is));
+		h.prior = readDouble(is);
+		h.likelihood = readDouble(is);
+		h.posterior = readDouble(is);
+		top.add(h);
+	}
+}
+
+template <typename LangHyp>
+void runTradeoffSweep(
+		size_t nObs,
+		size_t cSize,
+		const std::vector<double>& weights,
+		std::mt19937& rng,
+		size_t searchDepth,
+		const std::filesystem::path& dir,
+		bool weightFolders = true
+	);
+
 // This returns a TopN object with the best N hypotheses
 template <typename LangHyp>
 void runTradeoffAnalysis(
@@ -18,11 +58,131 @@ void runTradeoffAnalysis(
 	// TopN object to store the best hypotheses
 	TopN<LangHyp> top(size_t{FleetArgs::steps});
 
-	auto h0 = LangHyp::sample();
+	// the best warm start if there is one (see warmStart.h)
+	auto h0 = warmStart.start<LangHyp>(likelihoodWeight, 0, FleetArgs::nchains);
+
+	if (speculativeWidth > 0 || screenSize > 0) {
+		// Independent speculative and/or delayed acceptance
+		// chains instead of parallel tempering (see speculative.h)
+		std::mutex outputMutex;
+		size_t i = 0;
+		std::vector<SpeculativeChain<LangHyp>> chains;
+		for (size_t c = 0; c < FleetArgs::nchains; c++) {
+			chains.emplace_back(
+				warmStart.start<LangHyp>(likelihoodWeight, c, FleetArgs::nchains),
+				speculativeWidth,
+				rng(),
+				1.0,
+				screenSize
+			);
+		}
+
+		// The chains run in rounds of roundSteps steps,
+		// and checkpoint between rounds
+		CheckpointTimer timer;
+		auto save = [&](std::ostream& os) {
+			writeFileSize(os, hypfilepath);
+			writeFileSize(os, datafilepath);
+			writeValue(os, uint64_t(i));
+			saveTop(os, top);
+			paretoFrontier.save(os);
+			for (auto& chain : chains) chain.save(os);
+		};
+		if (resumeRun) {
+			readCheckpoint(checkpointPath, [&](std::istream& is) {
+				restoreFileSize(is, hypfilepath);
+				restoreFileSize(is, datafilepath);
+				i = readSize(is);
+				loadTop(is, top);
+				paretoFrontier.load<LangHyp>(is);
+				for (auto& chain : chains) chain.load(is);
+			});
+			std::cout << "Resumed at step " << chains[0].steps << std::endl;
+		}
+		// a signal stops the chains wherever they are in the
+		// round, so rounds go by the chain that is furthest behind,
+		// and end at multiples of roundSteps as they would have
+		auto behind = [&]() {
+			size_t steps = chains[0].steps;
+			for (auto& chain : chains) steps = std::min(steps, chain.steps);
+			return steps;
+		};
+		size_t round = std::max(roundSteps, size_t(1));
+		while (behind() < FleetArgs::steps) {
+			size_t until = std::min(
+				(behind() / round + 1) * round,
+				size_t{FleetArgs::steps}
+			);
+			std::vector<std::thread> threads;
+			for (auto& chain : chains) {
+				threads.emplace_back([&] {
+					chain.run(until, [&](const LangHyp& h) {
+						std::lock_guard lock(outputMutex);
+						top.add(h);
+						if (writeFullDump) {
+							addLineToHypCSV(hypfilepath, h);
+							addLineToDataFile(datafilepath, h);
+						}
+						if (FleetArgs::print > 0 && i % FleetArgs::print == 0) {
+							h.print();
+						}
+						std::cout << i << " " << std::flush;
+						i++;
+					});
+				});
+			}
+			for (auto& t : threads) t.join();
+			if (timer.due()) {
+				writeCheckpoint(checkpointPath, save);
+				std::cout << "Checkpoint at step " << behind() << std::endl;
+				if (timer.done()) return;
+			}
+		}
+		for (auto& chain : chains) {
+			std::cout 
+				<< "Chain: " << chain.steps << " steps, "
+				<< chain.accepted << " accepted, "
+				<< chain.evaluated << " full likelihoods";
+			if (screenSize > 0) {
+				std::cout
+					<< ", " << chain.passed << "/" << chain.screened 
+					<< " passed the screen";
+			}
+			std::cout
+				<< ", throughput gain " << chain.throughputGain()
+				<< std::endl;
+		}
+		std::cout 
+			<< "Contexts per likelihood: " << LangHyp::meanContextsUsed()
+			<< std::endl;
+		std::cout << "Top hypotheses" << std::endl;
+		top.print();
+		paretoFrontier.write();
+		return;
+	}
+
+	if (!checkpointPath.empty()) {
+		// The state of ParallelTempering is inside Fleet and cannot
+		// be saved, so a run with checkpoints does the same replica
+		// exchange over the chains of this project, which can.
+		// It is a sweep with a single weight, writing to this folder
+		runTradeoffSweep<LangHyp>(
+			nObs,
+			cSize,
+			{likelihoodWeight},
+			rng,
+			searchDepth,
+			hypfilepath.parent_path(),
+			false
+		);
+		return;
+	}
 
 	// initialize empty data
 	typename LangHyp::data_t emptyData;
-	// the last argument is the max temperature
+	// the last argument is the max temperature.
+	// All its chains start from h0, so a warm start
+	// only gives them its best hypothesis
 	ParallelTempering<LangHyp> samp(
 		h0,
 		&emptyData,
@@ -38,16 +198,399 @@ void runTradeoffAnalysis(
 	/* 		| top */ 
 	/* 		| printer(FleetArgs::print)){ */
 			
-			addLineToHypCSV(hypfilepath, h);
-			addLineToDataFile(datafilepath, h);
+			if (writeFullDump) {
+				addLineToHypCSV(hypfilepath, h);
+				addLineToDataFile(datafilepath, h);
+			}
 			std::cout << i << " " << std::flush;
 			i++;
 
 			// Hypotheses are added to top with the pipe operator above
 		}
 
+	std::cout 
+		<< "Contexts per likelihood: " << LangHyp::meanContextsUsed()
+		<< std::endl;
 	std::cout << "Top hypotheses" << std::endl;
 	top.print();
+	paretoFrontier.write();
 	/* return top; */
 }
 
+
+// Runs the tradeoff analysis for several likelihood weights at once.
+// The posterior of weight w at temperature T is 
+//   prior + w*commAcc/T,
+// and commAcc does not depend on w, so every (weight, temperature)
+// is a chain with likelihood commAcc at temperature T/w,
+// and they all form one ladder for replica exchange.
+// All chains share the same contexts, whose pool moves on between
+// rounds of roundSteps steps (a slice every --poolrefresh rounds),
+// so that they can share one cache of the likelihoods of the
+// hypotheses they visit.
+// Each weight gets its own folder with hyp.csv and data.txt,
+// from its chain at temperature 1, with the likelihood
+// scaled by the weight as in a run with that weight alone
+// (without weightFolders, a single weight writes them to dir).
+template <typename LangHyp>
+void runTradeoffSweep(
+		size_t nObs,
+		size_t cSize,
+		const std::vector<double>& weights,
+		std::mt19937& rng,
+		size_t searchDepth,
+		const std::filesystem::path& dir,
+		bool weightFolders
+	){
+
+	for (double w : weights) {
+		// the temperature of commAcc is T/w
+		if (!(w > 0)) {
+			throw std::runtime_error("The sweep needs positive weights");
+		}
+	}
+
+	// the likelihood of the chains is commAcc itself
+	LangHyp::setParams(nObs, cSize, 1.0, rng, searchDepth);
+
+	using Chain = SpeculativeChain<LangHyp>;
+	typename Chain::Cache cache(1 << 16);
+	ContextPool pool = LangHyp::makeContextPool(rng());
+	std::vector<PooledContext> contexts = pool.next();
+
+	// temperatures of each weight, as in runTradeoffAnalysis
+	size_t nTemperatures = std::max(size_t{FleetArgs::nchains}, size_t(1));
+	std::vector<double> temperatures;
+	for (size_t t = 0; t < nTemperatures; t++) {
+		temperatures.push_back(nTemperatures == 1 ? 1.0 : 
+			std::pow(10.0, double(t) / (nTemperatures - 1)));
+	}
+
+	// one chain per (weight, temperature)
+	struct Replica {
+		double weight;
+		double temperature;
+		// inverse temperature of commAcc
+		double beta() const { return weight / temperature; }
+	};
+	std::vector<Replica> replicas;
+	std::vector<Chain> chains;
+	for (double w : weights) {
+		for (size_t t = 0; t < nTemperatures; t++) {
+			double T = temperatures[t];
+			replicas.push_back(Replica{w, T});
+			// the coldest chain of each weight gets
+			// the best warm start for that weight
+			chains.emplace_back(
+				warmStart.start<LangHyp>(w, t, nTemperatures),
+				std::max(speculativeWidth, size_t(1)),
+				rng(),
+				T / w,
+				screenSize
+			);
+			chains.back().useContexts(&contexts);
+			chains.back().useCache(&cache);
+		}
+	}
+	// replicas from the hottest to the coldest
+	std::vector<size_t> ladder(replicas.size());
+	std::iota(ladder.begin(), ladder.end(), 0);
+	std::sort(ladder.begin(), ladder.end(), [&](size_t a, size_t b) {
+		return replicas[a].beta() < replicas[b].beta();
+	});
+
+	// outputs of each weight
+	std::vector<std::filesystem::path> hypPaths, dataPaths;
+	std::vector<std::unique_ptr<TopN<LangHyp>>> tops;
+	for (double w : weights) {
+		auto wdir = weightFolders ? 
+			dir / ("likweight_" + std::to_string(w)) : dir;
+		std::filesystem::create_directories(wdir);
+		hypPaths.push_back(wdir / "hyp.csv");
+		dataPaths.push_back(wdir / "data.txt");
+		if (!resumeRun) initializeHypCSV(hypPaths.back());
+		tops.push_back(std::make_unique<TopN<LangHyp>>(size_t{FleetArgs::steps}));
+	}
+	std::mutex outputMutex;
+	// writes a state of a chain at temperature 1
+	auto output = [&](size_t r, const LangHyp& h) {
+		if (replicas[r].temperature != 1.0) return;
+		size_t w = r / nTemperatures;
+		LangHyp scaled = h;
+		scaled.likelihood = h.likelihood * replicas[r].weight;
+		scaled.posterior = scaled.prior + scaled.likelihood;
+		std::lock_guard lock(outputMutex);
+		tops[w]->add(scaled);
+		if (writeFullDump) {
+			addLineToHypCSV(hypPaths[w], scaled);
+			addLineToDataFile(dataPaths[w], scaled);
+		}
+	};
+
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+	size_t swaps = 0, swapsAccepted = 0;
+	size_t done = 0;
+	size_t swapEvery = std::max(roundSteps, size_t(1));
+
+	CheckpointTimer timer;
+	auto save = [&](std::ostream& os) {
+		for (size_t w = 0; w < weights.size(); w++) {
+			writeFileSize(os, hypPaths[w]);
+			writeFileSize(os, dataPaths[w]);
+			saveTop(os, *tops[w]);
+		}
+		paretoFrontier.save(os);
+		writeEngine(os, rng);
+		pool.save(os);
+		writeValue(os, uint64_t(contexts.size()));
+		for (auto& p : contexts) {
+			writeContext(os, p.context);
+			writeValue(os, uint64_t(p.seed));
+		}
+		for (size_t x : {done, swaps, swapsAccepted}) {
+			writeValue(os, uint64_t(x));
+		}
+		for (auto& chain : chains) chain.save(os);
+	};
+	if (resumeRun) {
+		readCheckpoint(checkpointPath, [&](std::istream& is) {
+			for (size_t w = 0; w < weights.size(); w++) {
+				restoreFileSize(is, hypPaths[w]);
+				restoreFileSize(is, dataPaths[w]);
+				loadTop(is, *tops[w]);
+			}
+			paretoFrontier.load<LangHyp>(is);
+			readEngine(is, rng);
+			pool.load(is);
+			contexts.resize(readSize(is));
+			for (auto& p : contexts) {
+				t_context c = readContext(is);
+				p = poolContext(c, readSize(is));
+			}
+			for (size_t* x : {&done, &swaps, &swapsAccepted}) {
+				*x = readSize(is);
+			}
+			for (auto& chain : chains) chain.load(is);
+		});
+		std::cout << "Resumed at step " << done << std::endl;
+	}
+
+	while (done < FleetArgs::steps) {
+		size_t until = std::min(done + swapEvery, size_t{FleetArgs::steps});
+		// the chains take turns on --threads threads
+		runOnThreads(chains.size(), FleetArgs::nthreads, [&](size_t r) {
+			chains[r].run(until, [&](const LangHyp& h) { output(r, h); });
+		});
+
+		// A signal stopped the chains in the middle of the round:
+		// checkpoint before the swaps, and the round picks up from
+		// where each chain stopped (done is still its start)
+		if (checkpointRequested()) {
+			writeCheckpoint(checkpointPath, save);
+			std::cout << "Checkpoint in the round from step " << done << std::endl;
+			if (timer.done()) return;
+			continue;
+		}
+
+		// Swap neighbours in the ladder, alternating the pairs.
+		// The likelihoods are on the same contexts, so they compare
+		size_t round = done / swapEvery;
+		for (size_t k = round % 2; k + 1 < ladder.size(); k += 2) {
+			size_t a = ladder[k], b = ladder[k+1];
+			double la = chains[a].state().likelihood;
+			double lb = chains[b].state().likelihood;
+			double ratio = (replicas[a].beta() - replicas[b].beta()) * (lb - la);
+			swaps++;
+			if (std::log(uniform(rng)) < ratio) {
+				chains[a].exchange(chains[b]);
+				swapsAccepted++;
+				output(a, chains[a].state());
+				output(b, chains[b].state());
+			}
+		}
+
+		// New contexts invalidate the cached likelihoods,
+		// and the likelihoods of the current states
+		size_t generation = pool.generation();
+		contexts = pool.next();
+		if (pool.generation() != generation) {
+			cache.clear();
+			for (auto& chain : chains) chain.reevaluate();
+		}
+		done = until;
+		std::cout << until << " " << std::flush;
+
+		if (timer.due()) {
+			writeCheckpoint(checkpointPath, save);
+			std::cout << "Checkpoint at step " << done << std::endl;
+			if (timer.done()) return;
+		}
+	}
+
+	std::cout 
+		<< std::endl << "Swaps: " << swapsAccepted << "/" << swaps 
+		<< ", cached likelihoods: " << cache.size()
+		<< std::endl;
+	for (size_t w = 0; w < weights.size(); w++) {
+		std::cout << "Top hypotheses, weight " << weights[w] << std::endl;
+		tops[w]->print();
+	}
+	paretoFrontier.write();
+}
+
+
+// Runs the tradeoff analysis by enumerating every hypothesis
+// up to a size or down to a prior, instead of sampling them.
+// Only one hypothesis of each behaviour is evaluated, the simplest
+// (see enumeration.h), all on the same contexts, so frontier.csv
+// is the exact frontier of the tradeoff for the enumerated ones,
+// for every weight at once. hyp.csv gets every evaluated hypothesis,
+// with the likelihood at likelihoodWeight, from the highest prior.
+template <typename LangHyp>
+void runTradeoffEnumeration(
+		size_t nObs,
+		size_t cSize,
+		double likelihoodWeight,
+		std::mt19937& rng,
+		size_t searchDepth,
+		size_t maxNodes,
+		double minPrior,
+		std::filesystem::path& datafilepath,
+		std::filesystem::path& hypfilepath
+	){
+
+	LangHyp::setParams(nObs, cSize, likelihoodWeight, rng, searchDepth);
+
+	std::vector<std::string> programs = enumerateDistinctPrograms(
+		grammar,
+		grammar.template nt<typename LangHyp::output_t>(),
+		cSize,
+		maxNodes,
+		minPrior
+	);
+
+	ContextPool pool = LangHyp::makeContextPool(rng());
+	const std::vector<PooledContext> contexts = pool.next();
+
+	// All the hypotheses are on the same contexts, so they are
+	// evaluated in batches, one per thread, and the task pool
+	// helps inside each batch (see Agent::evaluateBatch)
+	std::vector<LangHyp> hs;
+	for (auto& program : programs) {
+		hs.emplace_back(program);
+		hs.back().prior = hs.back().compute_prior();
+	}
+	typename SpeculativeChain<LangHyp>::Cache* noCache = nullptr;
+	std::vector<double> values = cachedLikelihoods(
+		hs, contexts, noCache, FleetArgs::nthreads);
+	for (size_t k = 0; k < hs.size(); k++) {
+		hs[k].likelihood = values[k];
+		hs[k].posterior = hs[k].prior + hs[k].likelihood;
+	}
+
+	TopN<LangHyp> top(size_t{FleetArgs::steps});
+	for (auto& h : hs) {
+		top.add(h);
+		if (writeFullDump) {
+			addLineToHypCSV(hypfilepath, h);
+			addLineToDataFile(datafilepath, h);
+		}
+	}
+
+	std::cout 
+		<< "Evaluated " << hs.size() << " hypotheses, "
+		<< paretoFrontier.size() << " on the frontier"
+		<< std::endl;
+	std::cout << "Top hypotheses" << std::endl;
+	top.print();
+	paretoFrontier.write();
+}
+
+
+// Runs the tradeoff analysis with Sequential Monte Carlo from
+// weight 0 (the prior) to likelihoodWeight (see smc.h).
+// smc.csv in dir gets the particles of every generation with
+// its weight, i.e. samples from the posterior at each weight
+// on the way, and the estimate of the log evidence there.
+// hyp.csv gets the particles at likelihoodWeight.
+template <typename LangHyp>
+void runTradeoffSMC(
+		size_t nObs,
+		size_t cSize,
+		double likelihoodWeight,
+		std::mt19937& rng,
+		size_t searchDepth,
+		const std::filesystem::path& dir,
+		std::filesystem::path& datafilepath,
+		std::filesystem::path& hypfilepath
+	){
+
+	if (resumeRun || !checkpointPath.empty()) {
+		std::cerr 
+			<< "Checkpoints need --speculative, --screen or --weights" 
+			<< std::endl;
+		if (resumeRun) return;
+	}
+	if (likelihoodWeight <= 0) {
+		throw std::runtime_error("SMC needs a positive --likelihoodweight");
+	}
+
+	// the likelihood of the particles is commAcc itself
+	LangHyp::setParams(nObs, cSize, 1.0, rng, searchDepth);
+
+	SMCSampler<LangHyp> smc(smcParticles, rng(), LangHyp::makeContextPool(rng()));
+
+	std::filesystem::path smcpath = dir / "smc.csv";
+	{
+		std::ofstream file(smcpath);
+		file 
+			<< "generation,weight,logevidence,prior,commacc,hypothesis,serialized"
+			<< std::endl;
+	}
+	auto writeGeneration = [&] {
+		std::ofstream file(smcpath, std::ios_base::app);
+		for (auto& p : smc.particles) {
+			file
+				<< smc.generation
+				<< "," << smc.weight
+				<< "," << smc.logEvidence
+				<< "," << p.prior
+				<< "," << p.likelihood
+				<< "," << p.string()
+				<< "," << p.serialize()
+				<< std::endl;
+		}
+	};
+	writeGeneration();
+
+	while (!smc.done(likelihoodWeight)) {
+		smc.step(likelihoodWeight);
+		writeGeneration();
+		std::cout 
+			<< "Generation " << smc.generation 
+			<< ": weight " << smc.weight
+			<< ", log evidence " << smc.logEvidence
+			<< ", acceptance " << double(smc.accepted) / smc.steps
+			<< std::endl;
+	}
+
+	// the particles, with the likelihood scaled by the
+	// weight as in a run with that weight
+	TopN<LangHyp> top(size_t{FleetArgs::steps});
+	for (auto p : smc.particles) {
+		p.likelihood *= likelihoodWeight;
+		p.posterior = p.prior + p.likelihood;
+		top.add(p);
+		if (writeFullDump) {
+			addLineToHypCSV(hypfilepath, p);
+			addLineToDataFile(datafilepath, p);
+		}
+	}
+
+	std::cout 
+		<< "Contexts per likelihood: " << LangHyp::meanContextsUsed()
+		<< std::endl;
+	std::cout << "Top hypotheses" << std::endl;
+	top.print();
+	paretoFrontier.write();
+}
@@ -13,8 +13,16 @@ t_contextVector generateContextVariations(const t_context& context) {
 
 	// a vector of contexts
     t_contextVector variations;
-    int N = context.size();
-    int totalCombinations = 1 << N;
+    size_t N = context.size();
+	// The agent itself uses Gray-code enumeration or counting
+	// (see listen), this is only for small contexts
+	if (N > 30) {
+		throw std::runtime_error(
+			"Too many context variations for context size "
+			+ std::to_string(N)
+		);
+	}
+    size_t totalCombinations = size_t(1) << N;
 
     // Store the int values from the original context
     std::vector<int> intValues;
@@ -22,15 +30,14 @@ t_contextVector generateContextVariations(const t_context& context) {
         intValues.push_back(std::get<0>(tuple));
     }
 
-    for (int i = 0; i < totalCombinations; ++i) {
-        std::bitset<32> binary(i);
+    for (size_t i = 0; i < totalCombinations; ++i) {
         t_context newContext;
         /* for (const auto& tuple : context) { */
 		// loop over the size of the context
-		for (int j = 0; j < N; ++j) {
+		for (size_t j = 0; j < N; ++j) {
             newContext.insert(std::make_tuple(
 				intValues[j],
-				binary[j]
+				bool((i >> j) & 1)
 			));
         }
 
@@ -57,6 +64,10 @@ private:
 	double leafProb;
 	double alpha;
 	double sizeScaling;
+	// how the listener goes through the target variations
+	ListenerMode listenerMode;
+	// budget and error target of the sampling listener
+	MonteCarloSettings monteCarlo;
 	
 	// the chosen hypothesis
 	Hyp chosenHyp;
@@ -66,6 +77,50 @@ private:
 	std::optional<Hyp> originalHyp = std::nullopt;
 	bool mutated = false;
 
+	// What the chosen hypothesis tells the compiler about its 
+	// part of the language, if its meanings can be compiled
+	std::optional<CompiledSemantics> semantics = std::nullopt;
+	// compiled meaning of each sentence seen so far
+	// (nullptr if it cannot be compiled)
+	mutable std::map<std::string, t_cnode> compiledSentences;
+
+	// The sentences of an enumeration, which only depend on the
+	// terminals, the composition types and the depth
+	struct SentenceBank {
+		t_terminalsMap terminalsMap;
+		t_cfgMap cfgMap;
+		size_t searchDepth;
+		std::vector<std::string> strings;
+		std::vector<double> complexity;
+		// the words of each sentence
+		std::vector<std::set<std::string>> words;
+	};
+
+	// An enumeration scored with compiled meanings: the truth
+	// and informativity of every sentence of a bank in every
+	// context, and the compiled parts of the hypothesis
+	// that the meanings came from
+	struct ScoredEnumeration {
+		std::shared_ptr<const SentenceBank> bank;
+		std::vector<std::pair<uint32_t, t_context>> contexts;
+		// the composition rule (under "") and the quantifiers
+		std::map<std::string, std::string> parts;
+		std::vector<uint8_t> truth;
+		std::vector<double> informativity;
+	};
+
+	// Enumerations kept per thread, since the hypotheses of a chain
+	// are evaluated one after another on the same thread
+	static constexpr size_t maxScoredEnumerations = 4;
+	static std::vector<std::shared_ptr<const SentenceBank>>& sentenceBanks() {
+		static thread_local std::vector<std::shared_ptr<const SentenceBank>> banks;
+		return banks;
+	}
+	static std::deque<ScoredEnumeration>& scoredEnumerations() {
+		static thread_local std::deque<ScoredEnumeration> scored;
+		return scored;
+	}
+
 	double computeComplexity(BTC& sentence) const{
 		// The complexity of the tree is just
 		// the number of terminal nodes
@@ -80,29 +135,9 @@ private:
 		// except for the target feature,
 		// the possible contexts are the ones that differ
 		// from the observed one wrt what's a target.
-		// Therefore, I loop through the possible contexts
-		t_contextVector possibleContexts = 
-			generateContextVariations(observedC);
-		int nTrue = 0;
-		for (t_context c : possibleContexts) {
-			// catch 'PresuppositionFailure' exception
-
-			try {
-				nTrue = nTrue + meaning(c);
-			} catch (PresuppositionFailure& e) {
-				// if the meaning fails to compute
-				// it means that the context is not
-				// compatible with the meaning
-				// so we just ignore it
-				continue;
-			}
-		}
-		// compute informativity against 
-		// set of all possible alternatives
-		return -std::log(
-			(double)nTrue/
-			(double)possibleContexts.size()
-		);
+		// Informativity is computed against 
+		// the set of all possible alternatives
+		return listen(meaning, observedC).informativity();
 	}
 
 	// Generates a random tree
@@ -259,6 +294,9 @@ public:
 		// to pick one to refer to the state
 		// *Onliy used in the case of sampling*
 		nSamples = 5000;
+		// exact in any case, see counting.h
+		listenerMode = defaultListenerMode;
+		monteCarlo = defaultMonteCarlo;
 	}
 
 	Agent(Hyp hyp) : Agent() {
@@ -279,63 +317,124 @@ public:
 
 		// Communicative accuracy is the total surprisal
 		// of the listener over the unobserved data
-		// after receiving the signal
-		double cumCA = 0;
+		// after receiving the signal.
+		// Compiled utterances are compiled here first, so that
+		// the listener can interpret them in parallel
+		std::vector<t_cnode> compiled;
+		bool allCompiled = true;
+		for (auto& datum : data) {
+			compiled.push_back(this->compileMeaning(datum.output));
+			allCompiled = allCompiled && compiled.back();
+		}
+		std::vector<double> terms(data.size(), 0.0);
 		// the data_t is a vector of datum_t
 		// each datum is a tuple of (context, utterance string)
-		for (auto datum : data) {
+		auto accuracy = [&](size_t i) {
 
+			const auto& datum = data[i];
 			// Check if datum.input and datum.output are valid
 			if (datum.input.empty() || datum.output.empty()) {
-				continue;
+				return;
 			}
 			// Get the context
-			t_context c = datum.input;
+			const t_context& c = datum.input;
 			// Get the second element of each tuple in context
 			// which says whether the element is a target.
-			std::vector<bool> targets;
+			std::vector<uint8_t> targets;
 			for (auto elem : c) { targets.push_back(std::get<1>(elem)); }
 
-			// Get the utterance *as a string*
-			std::string utt = datum.output;
-
-			// interpret the utterance, which gives the 
+			// interpret the utterance (a string), which gives the 
 			// P(i is a target|utterance) for each i in context
-			std::vector<double> probs = this->interpret(utt, c);
-			// check that probs is not empty
-			/* if (probs != NULL) */ 
-			// if different from null, check that probs and targets
-			// have the same size
+			std::vector<double> probs = compiled[i] ?
+				this->listen(compiled[i], c).marginals :
+				this->interpret(datum.output, c);
+			// check that probs and targets have the same size
 			if (probs.size() != targets.size()) {
 				std::cerr 
 					<< "Size mismatch between probs and targets." 
 					<< std::endl;
-				continue;
+				return;
 			}
 			// compute total surprisal of targetness of elements
 			// in the context with the P(target|utterance)
 			// NOTE: This is not weighted by the P(target|utt):
 			// we are interested in total surprisal for the whole context!
-			double CA = 0;
-			for (size_t i = 0; i < targets.size(); i++) {
-				if (targets[i] == 0) {
-					// if the element is not a target
-					// then we care about the probability of it being 0
-					CA += std::log(1 - probs[i]);
-				} else {
-					// if the element is a target then 
-					// the probability of it being 1
-					CA += std::log(probs[i]);
-				}
-			}
-			cumCA += CA;
+			terms[i] = targetLogLikelihood(
+				probs.data(),
+				targets.data(),
+				targets.size()
+			);
+		};
+		// Closures may call back into the hypothesis,
+		// which is not safe to do from several threads
+		if (allCompiled) {
+			taskPool.parallelFor(data.size(), accuracy);
+		} else {
+			for (size_t i = 0; i < data.size(); i++) accuracy(i);
 		}
+		// sum in order, so the result does not depend on threads
+		double cumCA = 0;
+		for (double CA : terms) cumCA += CA;
 		// normalize by the number of observations
 		// to get the average surprisal of an observation
 		cumCA /= data.size();
 		return cumCA;
 	}
 
+	// Same, for data produced from the contexts of a pool
+	// (in the same order), reusing what the pool
+	// has derived from each context
+	double communicativeAccuracy(
+			const typename Hyp::data_t& data,
+			const std::vector<PooledContext>& cs
+		) const {
+		double cumCA = 0;
+		for (double CA : contextAccuracies(data, cs)) cumCA += CA;
+		cumCA /= data.size();
+		return cumCA;
+	}
+
+	// The surprisal of the listener in each context of a pool,
+	// e.g. to estimate communicative accuracy sequentially
+	std::vector<double> contextAccuracies(
+			const typename Hyp::data_t& data,
+			const std::vector<PooledContext>& cs
+		) const {
+
+		assert(hasChosenHyp&&"No hypothesis has been set yet");
+		assert(data.size() == cs.size());
+
+		std::vector<t_cnode> compiled;
+		bool allCompiled = true;
+		for (auto& datum : data) {
+			compiled.push_back(this->compileMeaning(datum.output));
+			allCompiled = allCompiled && compiled.back();
+		}
+		std::vector<double> terms(data.size(), 0.0);
+		auto accuracy = [&](size_t b) {
+			const t_context& c = cs[b].context;
+			const std::string& utt = data[b].output;
+			if (c.empty() || utt.empty()) {
+				return;
+			}
+			std::vector<double> probs = compiled[b] ?
+				listen(compiled[b], cs[b]).marginals :
+				this->interpret(utt, c);
+			const std::vector<uint8_t>& targets = cs[b].observed.targets;
+			terms[b] = targetLogLikelihood(
+				probs.data(),
+				targets.data(),
+				targets.size()
+			);
+		};
+		if (allCompiled) {
+			taskPool.parallelFor(data.size(), accuracy);
+		} else {
+			for (size_t b = 0; b < data.size(); b++) accuracy(b);
+		}
+		return terms;
+	}
+
 	// The agent sees a world of objects
 	// They have to produce a signal that 
 	// helps the listener identify the targets.
@@ -381,36 +480,32 @@ public:
 			return std::nullopt;
 		} else {
 
-			// Calculates the utility of each sentence
-			std::vector<double> utilities;
-			for (auto& s : sentences) {
+			// Scores the sentences as a batch with a single context.
+			// All the sentences are true in the context.
+			ScoreBatch batch(1, sentences.size());
+			batch.logVariations[0] = c.size() * std::log(2.0);
+			for (size_t i = 0; i < sentences.size(); i++) {
 
-				t_t_M meaning = std::get<t_t_M>(s->compose(compositionFn));
+				t_t_M meaning = std::get<t_t_M>(sentences[i]->compose(compositionFn));
 
+				batch.truth[i] = 1;
 				// compute informativity
-				double info = this->computeInformativity(c, meaning);
-
+				batch.informativity[i] = this->computeInformativity(c, meaning);
 				// compute complexity (multiply by sizeScaling
 				// to make more comparable with info);
-				double complexity = 
-					this->computeComplexity(*s) * this->sizeScaling;
-
-				double utility = std::exp(this->alpha*(info - complexity));
-
-				/* s->printTree(this->lex); */
-				/* std::cout << "info: " << info << std::endl; */
-				/* std::cout << "comp: " << complexity << std::endl; */
-				/* std::cout << utility << std::endl; */
-				/* std::cout << std::endl; */
-
-				// Since this ends up as parameter to a 
-				// discrete distribution, we don't need to
-				// normalize.
-				utilities.push_back(utility);
+				batch.complexity[i] = 
+					this->computeComplexity(*sentences[i]) * this->sizeScaling;
 			}
 
+			// Utilities stay in log space and are normalized
+			// inside the kernel, so large alphas cannot overflow
+			scoreSpeakerListener(batch, this->alpha);
+
 			// Selects an informative and simple utterance
-			t_discr_dist dist(utilities.begin(),utilities.end());
+			t_discr_dist dist(
+				batch.speakerProbs.begin(),
+				batch.speakerProbs.end()
+			);
 
 			return std::make_tuple(
 				std::move(sentences),
@@ -482,6 +577,58 @@ public:
 		) const {
 
 		typename Hyp::data_t data;
+		std::vector<std::string> strings;
+		ScoreBatch batch = scoreEnumeration(
+			poolContexts(cs), searchDepth, strings);
+
+		// Select a single string per context
+		for (size_t b = 0; b < cs.size(); b++) {
+			data.push_back(typename Hyp::datum_t{
+				cs[b], 
+				selectSentence(batch, b, strings, rng),
+				1.0
+			});
+		}
+		return data;
+	}
+
+	// Same with the contexts of a pool (see contextPool.h).
+	// The choice in each context uses the seed of the context,
+	// so hypotheses evaluated on the same pool share the
+	// speaker's randomness as well as the contexts.
+	typename Hyp::data_t produceDataFromEnumeration(
+			const std::vector<PooledContext>& cs, 
+			size_t searchDepth = 2
+		) const {
+
+		typename Hyp::data_t data;
+		std::vector<std::string> strings;
+		ScoreBatch batch = scoreEnumeration(cs, searchDepth, strings);
+
+		for (size_t b = 0; b < cs.size(); b++) {
+			std::mt19937 rng(cs[b].seed);
+			data.push_back(typename Hyp::datum_t{
+				cs[b].context, 
+				selectSentence(batch, b, strings, rng),
+				1.0
+			});
+		}
+		return data;
+	}
+
+	// Scores every sentence up to searchDepth in every context.
+	// Fills strings with the sentences, one per column of the batch
+	ScoreBatch scoreEnumeration(
+			const std::vector<PooledContext>& cs, 
+			size_t searchDepth,
+			std::vector<std::string>& strings
+		) const {
+
+		if (semantics.has_value()) {
+			auto batch = scoreCompiledEnumeration(cs, searchDepth, strings);
+			if (batch.has_value()) return std::move(*batch);
+		}
+
 		auto trueHyp = this->getHypothesis();
 
 		// get everything from the trueHyp
@@ -498,45 +645,364 @@ public:
 				searchDepth
 			);
 
-		// loop over contexts
-		for (auto& context : cs) {
+		// Compose the meaning and compute the complexity
+		// of every sentence once for all contexts
+		std::vector<t_t_M> meanings;
+		std::vector<t_cnode> compiled;
+		strings.clear();
+		ScoreBatch batch(cs.size(), allSentences.size());
+		for (size_t s = 0; s < allSentences.size(); s++) {
+			meanings.push_back(
+				std::get<t_t_M>(allSentences[s]->compose(compositionFn))
+			);
+			strings.push_back(allSentences[s]->toSExpression());
+			compiled.push_back(this->compileMeaning(strings.back()));
+			batch.complexity[s] = 
+				this->computeComplexity(*allSentences[s]) * this->sizeScaling;
+		}
 
-			// select the true sentences in context
-			t_BTC_vec sentences = selectTrueSentences(
-					context,
-					compositionFn,
-					copyBTCVec(allSentences)
-				);
-			
-			// Define a distribution over sentences
-			// NOTE: this moves 'sentences' so it is no longer usable
-			std::optional<t_BTC_dist> sentencesDist = produce(
-					context,
-					compositionFn,
-					lex,
-					terminalsMap,
-					rng,
-					sentences
-				);
+		// Fill the truth matrix and the informativity 
+		// of the true sentences in each context.
+		// Contexts only write their own row of the batch,
+		// so they can be scored in parallel
+		bool allCompiled = true;
+		for (auto& c : compiled) allCompiled = allCompiled && c;
+		auto score = [&](size_t b) {
+			const t_context& context = cs[b].context;
+			batch.logVariations[b] = context.size() * std::log(2.0);
+			for (size_t s = 0; s < meanings.size(); s++) {
+				// Compiled meanings give truth and informativity
+				// from a single pass over the variations
+				if (compiled[s]) {
+					ListenerPosterior post = listen(compiled[s], cs[b]);
+					batch.truth[batch.index(b,s)] = post.observedTrue;
+					batch.informativity[batch.index(b,s)] = 
+						post.informativity();
+					continue;
+				}
+				bool truthvalue;
+				try {
+					truthvalue = meanings[s](context);
+				} catch (PresuppositionFailure& e) {
+					// Presupposition failures are not true
+					truthvalue = false;
+				}
+				if (truthvalue) {
+					batch.truth[batch.index(b,s)] = 1;
+					batch.informativity[batch.index(b,s)] = 
+						this->computeInformativity(context, meanings[s]);
+				}
+			}
+		};
+		// Closures may call back into the hypothesis,
+		// which is not safe to do from several threads
+		if (allCompiled) {
+			taskPool.parallelFor(cs.size(), score);
+		} else {
+			for (size_t b = 0; b < cs.size(); b++) score(b);
+		}
 
-			// Select a single string
-			std::optional<std::string> maybestring = produceSingleString(
-					context,
-					rng,
-					sentencesDist
-				);
+		// Speaker distribution in every context at once
+		scoreSpeakerListener(batch, this->alpha);
+		return batch;
+	}
 
-			if (maybestring.has_value()) {
-				data.push_back(typename Hyp::datum_t{
-					context, 
-					*maybestring, 
+	// The same for a hypothesis with compiled meanings, reusing what
+	// earlier enumerations on this thread found (or nothing if some
+	// sentence cannot be compiled).
+	// The sentences are enumerated once for each set of terminals
+	// and composition types, which the hypotheses of a chain share.
+	// A sentence only depends on the hypothesis through the learned
+	// words it mentions, and through the composition rule if it
+	// mentions any quantifier. So when the hypothesis differs from
+	// an earlier one on the same contexts only in some of these parts
+	// (e.g. a proposal that changed Q2, see proposals.h), only the
+	// sentences that mention them are scored again, and the truth
+	// and informativity of the others are copied over.
+	std::optional<ScoreBatch> scoreCompiledEnumeration(
+			const std::vector<PooledContext>& cs, 
+			size_t searchDepth,
+			std::vector<std::string>& strings
+		) const {
+
+		auto trueHyp = this->getHypothesis();
+		LexicalSemantics lex 		= trueHyp.getLexicon();
+		t_terminalsMap terminalsMap = this->generateTerminalsMap(lex);
+		t_BTC_compose compositionFn = trueHyp.getCompositionF();
+		t_cfgMap cfgMap 			= this->generateCFGMap(compositionFn);
+
+		std::shared_ptr<const SentenceBank> bank;
+		for (auto& b : sentenceBanks()) {
+			if (b->searchDepth == searchDepth && 
+					b->terminalsMap == terminalsMap && b->cfgMap == cfgMap) {
+				bank = b;
+			}
+		}
+		if (!bank) {
+			auto fresh = std::make_shared<SentenceBank>(
+				SentenceBank{terminalsMap, cfgMap, searchDepth});
+			for (auto& s : enumerateSentences(compositionFn, lex, terminalsMap, searchDepth)) {
+				fresh->strings.push_back(s->toSExpression());
+				fresh->complexity.push_back(this->computeComplexity(*s) * this->sizeScaling);
+				std::istringstream words(fresh->strings.back());
+				std::set<std::string> w;
+				for (std::string word; words >> word; ) {
+					if (word != "(" && word != ")") w.insert(word);
+				}
+				fresh->words.push_back(std::move(w));
+			}
+			bank = fresh;
+			sentenceBanks().push_back(bank);
+		}
+
+		ScoredEnumeration scored{bank};
+		for (auto& c : cs) scored.contexts.emplace_back(c.seed, c.context);
+		scored.parts[""] = semantics->compRule ? 
+			cnodeToString(semantics->compRule) : "application";
+		for (auto& [word, q] : semantics->quantifiers) {
+			scored.parts[word] = cnodeToString(q);
+		}
+
+		// The sentences to score: those that mention a part
+		// that differs from the closest earlier enumeration
+		size_t nS = bank->strings.size();
+		std::vector<uint8_t> changed(nS, 1);
+		size_t nChanged = nS;
+		const ScoredEnumeration* previous = nullptr;
+		for (auto& earlier : scoredEnumerations()) {
+			if (earlier.bank != bank || earlier.contexts != scored.contexts) continue;
+			// the same quantifiers, possibly with other meanings
+			bool sameWords = earlier.parts.size() == scored.parts.size();
+			std::set<std::string> differ;
+			for (auto& [word, part] : scored.parts) {
+				auto it = earlier.parts.find(word);
+				if (it == earlier.parts.end()) sameWords = false;
+				else if (it->second != part) differ.insert(word);
+			}
+			if (!sameWords) continue;
+			std::vector<uint8_t> c(nS, 0);
+			size_t n = 0;
+			for (size_t s = 0; s < nS; s++) {
+				for (auto& [word, part] : scored.parts) {
+					if (word.empty() || !bank->words[s].count(word)) continue;
+					if (differ.count(word) || differ.count("")) c[s] = 1;
+				}
+				n += c[s];
+			}
+			if (n < nChanged) {
+				changed = std::move(c);
+				nChanged = n;
+				previous = &earlier;
+			}
+		}
+
+		std::vector<t_cnode> compiled(nS);
+		for (size_t s = 0; s < nS; s++) {
+			if (!changed[s]) continue;
+			compiled[s] = this->compileMeaning(bank->strings[s]);
+			if (!compiled[s]) return std::nullopt;
+		}
+
+		ScoreBatch batch(cs.size(), nS);
+		batch.complexity = bank->complexity;
+		if (previous) {
+			batch.truth = previous->truth;
+			batch.informativity = previous->informativity;
+		}
+		// Contexts only write their own row of the batch
+		taskPool.parallelFor(cs.size(), [&](size_t b) {
+			batch.logVariations[b] = cs[b].context.size() * std::log(2.0);
+			for (size_t s = 0; s < nS; s++) {
+				if (!changed[s]) continue;
+				ListenerPosterior post = listen(compiled[s], cs[b]);
+				batch.truth[batch.index(b,s)] = post.observedTrue;
+				batch.informativity[batch.index(b,s)] = post.informativity();
+			}
+		});
+
+		scored.truth = batch.truth;
+		scored.informativity = batch.informativity;
+		auto& recent = scoredEnumerations();
+		recent.push_front(std::move(scored));
+		if (recent.size() > maxScoredEnumerations) recent.pop_back();
+
+		strings = bank->strings;
+		// Speaker distribution in every context at once
+		scoreSpeakerListener(batch, this->alpha);
+		return batch;
+	}
+
+	// Samples the sentence of context b from the speaker distribution
+	std::string selectSentence(
+			const ScoreBatch& batch,
+			size_t b,
+			const std::vector<std::string>& strings,
+			std::mt19937& rng
+		) const {
+		if (!batch.hasTrueSentence(b)) {
+			throw std::runtime_error("No data produced");
+		}
+		auto first = batch.speakerProbs.begin() + batch.index(b,0);
+		t_discr_dist dist(first, first + batch.nSentences);
+		return strings[dist(rng)];
+	}
+
+	// What evaluateBatch finds for one hypothesis
+	struct Evaluation {
+		// the data its speaker produces in each context
+		typename Hyp::data_t data;
+		// the surprisal of its listener in each context
+		std::vector<double> accuracies;
+		// average surprisal of an observation
+		double commAcc = 0;
+	};
+
+	// Communicative accuracy of several hypotheses on the same
+	// contexts of a pool. The result for each hypothesis is the
+	// same as produceDataFromEnumeration and contextAccuracies,
+	// but what does not depend on the hypothesis is done once
+	// for the whole batch:
+	//  - the contexts come from the pool already observed,
+	//    partitioned and with their canonical keys,
+	//  - the sentences are enumerated once for all the hypotheses
+	//    with the same terminals and composition types (which
+	//    for QuantsHypothesis is all of them), and
+	//  - the listener runs once for each distinct compiled
+	//    meaning and context, so a sentence that means the same
+	//    under several hypotheses (e.g. one without learned words,
+	//    or with a quantifier they share) is interpreted once.
+	// The listener runs over (meaning, context) cells, and the
+	// speaker over hypotheses, both on the task pool.
+	// Hypotheses whose sentences cannot all be compiled go
+	// through their own agent one at a time.
+	static std::vector<Evaluation> evaluateBatch(
+			const std::vector<Hyp>& hs,
+			const std::vector<PooledContext>& cs,
+			size_t searchDepth = 2
+		) {
+
+		std::vector<Evaluation> results(hs.size());
+		std::vector<Agent> agents(hs.size());
+		for (size_t h = 0; h < hs.size(); h++) agents[h].setHypothesis(hs[h]);
+
+		// The sentences of each distinct set of terminals
+		// and composition types, with their complexity
+		std::map<std::pair<t_terminalsMap, t_cfgMap>, size_t> bankIndex;
+		std::vector<std::vector<std::string>> bankStrings;
+		std::vector<std::vector<double>> bankComplexity;
+		std::vector<size_t> bankOf(hs.size());
+		for (size_t h = 0; h < hs.size(); h++) {
+			Hyp hyp = agents[h].getHypothesis();
+			LexicalSemantics lex = hyp.getLexicon();
+			t_terminalsMap terminalsMap = agents[h].generateTerminalsMap(lex);
+			t_BTC_compose compositionFn = hyp.getCompositionF();
+			auto [it, added] = bankIndex.try_emplace(
+				std::make_pair(terminalsMap, agents[h].generateCFGMap(compositionFn)),
+				bankStrings.size()
+			);
+			bankOf[h] = it->second;
+			if (!added) continue;
+			t_BTC_vec sentences = agents[h].enumerateSentences(
+				compositionFn, lex, terminalsMap, searchDepth);
+			bankStrings.emplace_back();
+			bankComplexity.emplace_back();
+			for (auto& s : sentences) {
+				bankStrings.back().push_back(s->toSExpression());
+				bankComplexity.back().push_back(
+					agents[h].computeComplexity(*s) * agents[h].sizeScaling);
+			}
+		}
+
+		// The compiled meaning of every sentence under every
+		// hypothesis, by its canonical string
+		std::vector<std::vector<t_cnode>> compiled(hs.size());
+		std::vector<std::vector<std::string>> keys(hs.size());
+		std::vector<uint8_t> allCompiled(hs.size(), 1);
+		taskPool.parallelFor(hs.size(), [&](size_t h) {
+			for (auto& s : bankStrings[bankOf[h]]) {
+				compiled[h].push_back(agents[h].compileMeaning(s));
+				if (!compiled[h].back()) {
+					allCompiled[h] = 0;
+					return;
+				}
+				keys[h].push_back(cnodeToString(compiled[h].back()));
+			}
+		});
+
+		// The distinct meanings of the batch
+		std::unordered_map<std::string, size_t> meaningIndex;
+		std::vector<t_cnode> meanings;
+		std::vector<std::vector<size_t>> meaningOf(hs.size());
+		for (size_t h = 0; h < hs.size(); h++) {
+			if (!allCompiled[h]) continue;
+			for (size_t s = 0; s < keys[h].size(); s++) {
+				auto [it, added] = meaningIndex.try_emplace(
+					keys[h][s], meanings.size());
+				if (added) meanings.push_back(compiled[h][s]);
+				meaningOf[h].push_back(it->second);
+			}
+		}
+
+		// Truth and informativity of each meaning in each context.
+		// The listener only depends on the meaning and the settings,
+		// which are the same for all the agents
+		struct Cell {
+			uint8_t truth = 0;
+			double informativity = 0;
+		};
+		size_t nC = cs.size();
+		std::vector<Cell> cells(meanings.size() * nC);
+		if (!hs.empty()) {
+			const Agent& listener = agents[0];
+			taskPool.parallelFor(cells.size(), [&](size_t i) {
+				ListenerPosterior post = listener.listen(meanings[i / nC], cs[i % nC]);
+				cells[i] = Cell{post.observedTrue, post.informativity()};
+			});
+		}
+
+		// The speaker and the listener of each hypothesis
+		taskPool.parallelFor(hs.size(), [&](size_t h) {
+			if (!allCompiled[h]) return;
+			const std::vector<std::string>& strings = bankStrings[bankOf[h]];
+			ScoreBatch batch(nC, strings.size());
+			batch.complexity = bankComplexity[bankOf[h]];
+			for (size_t b = 0; b < nC; b++) {
+				batch.logVariations[b] = cs[b].context.size() * std::log(2.0);
+				for (size_t s = 0; s < strings.size(); s++) {
+					const Cell& cell = cells[meaningOf[h][s] * nC + b];
+					batch.truth[batch.index(b,s)] = cell.truth;
+					batch.informativity[batch.index(b,s)] = cell.informativity;
+				}
+			}
+			scoreSpeakerListener(batch, agents[h].alpha);
+			Evaluation& e = results[h];
+			for (size_t b = 0; b < nC; b++) {
+				std::mt19937 rng(cs[b].seed);
+				e.data.push_back(typename Hyp::datum_t{
+					cs[b].context,
+					agents[h].selectSentence(batch, b, strings, rng),
 					1.0
 				});
-			} else {
-				throw std::runtime_error("No data produced");
 			}
+			e.accuracies = agents[h].contextAccuracies(e.data, cs);
+		});
+
+		// Closures may call back into the hypothesis,
+		// which is not safe to do from several threads
+		for (size_t h = 0; h < hs.size(); h++) {
+			if (allCompiled[h]) continue;
+			Evaluation& e = results[h];
+			e.data = agents[h].produceDataFromEnumeration(cs, searchDepth);
+			e.accuracies = agents[h].contextAccuracies(e.data, cs);
 		}
-		return data;
+
+		// sum in order, so the result does not depend on threads
+		for (auto& e : results) {
+			e.commAcc = 0;
+			for (double CA : e.accuracies) e.commAcc += CA;
+			e.commAcc /= e.data.size();
+		}
+		return results;
 	}
 
 	typename Hyp::data_t produceData(
@@ -591,54 +1057,24 @@ public:
 		// get sentence meaning
 		t_t_M meaning = std::get<t_t_M>(s->compose(compositionFn));
 		
-		// loop over all possible contexts and compute the probability 
-		// of each element in the context being a target given the sentence.
-		// `probs` is a vector of 0s with the length of the context
+		// the probability of each element in the context 
+		// being a target given the sentence, over all the
+		// possible contexts where the sentence is true.
 		// NOTE: The agent can only see the first component 
 		// of each context element, which is an integer.
-		t_contextVector possibleContexts = 
-			generateContextVariations(observedC);
-		int numTrue = 0;
-		std::vector<double> probs(observedC.size(),0);
 		// Now ints are unique in the context!
-		for (auto& c : possibleContexts) {
-			bool truthvalue;
-			try {
-				truthvalue = meaning(c);
-				// if the sentence is true of the context
-				if (truthvalue) {
-					numTrue++;
-					// if so, update the probability of each element
-					// in the context being a target
-					int i = 0;
-					for (auto e : c) {
-						probs[i] += std::get<1>(e);
-						i++;
-					}
-					/* std::cout << " TRUE "; */
-				} else {
-					/* std::cout << " FALSE"; */
-				}
-			} catch (PresuppositionFailure& e) {
-				// If the sentence presupposes something
-				// that is not true of the context,
-				// then the context can be ignored.
-				/* std::cout << " PFAIL"; */
-			}
-		}
-		// normalize the probabilities
-		// (i.e. divide by the number of 
-		// possible contexts given sentence)
-		for (size_t i = 0; i < probs.size(); i++) {
-			probs[i] /= numTrue;
-		}
-		return probs;
+		return listen(meaning, observedC).marginals;
 	}
 
 	std::vector<double> interpret(
 			std::string s,
 			t_context observedC
 		) const {
+		// Compiled meanings are evaluated over all the
+		// target variations at once
+		if (t_cnode compiled = this->compileMeaning(s)) {
+			return listen(compiled, observedC).marginals;
+		}
 		// by default, use the chosen hypothesis
 		LexicalSemantics lex = this->getHypothesis().getLexicon();
 		// get the sentence
@@ -650,12 +1086,208 @@ public:
 		);
 	}
 	
+	// The literal listener: what a sentence meaning tells
+	// about the targets in every target variation of the context.
+	// Small contexts visit the variations in Gray-code order,
+	// so that each one only costs the update of a single entity.
+	// Counting targets per cell of similar entities (see counting.h)
+	// gives the same result for meanings that do not depend on the
+	// order of the entities, but closures like nTh or getEntity do,
+	// so closures are only counted when the hypothesis declares
+	// permutationInvariant (compiled meanings always are).
+	// When nothing exact is affordable, variations are sampled
+	// (see montecarlo.h) and the result is approximate.
+	ListenerPosterior listen(
+			const t_t_M& meaning,
+			const t_context& observedC
+		) const {
+		ObservedContext observed = observeContext(observedC);
+		const double nVariations = std::ldexp(1.0, observed.size());
+		IncrementalContext evaluator(meaning, observed);
+		// Closures are sampled unless visiting
+		// every variation is cheaper
+		if (listenerMode == ListenerMode::MonteCarlo) {
+			if (nVariations > monteCarlo.budget) {
+				// sentences that no sample makes true
+				// are counted when counting is exact
+				std::function<ListenerPosterior()> exact;
+				if constexpr (requires { requires Hyp::permutationInvariant; }) {
+					exact = [&]() {
+						CellPartition cells = partitionContext(observed);
+						CountContext counter(meaning, observed, cells);
+						return countingListener(observed, cells, counter);
+					};
+				}
+				return monteCarloListener(observed, evaluator, monteCarlo, exact);
+			}
+			return grayCodeListener(observed, evaluator);
+		}
+		if constexpr (requires { requires Hyp::permutationInvariant; }) {
+			if (listenerMode != ListenerMode::Enumerate) {
+				CellPartition cells = partitionContext(observed);
+				if (
+					listenerMode == ListenerMode::Counts ||
+					cells.nConfigurations() < nVariations
+				) {
+					CountContext counter(meaning, observed, cells);
+					return countingListener(observed, cells, counter);
+				}
+			}
+		}
+		if (
+			listenerMode != ListenerMode::Enumerate &&
+			observed.size() > maxGrayCodeContextSize
+		) {
+			return monteCarloListener(observed, evaluator, monteCarlo);
+		}
+		return grayCodeListener(observed, evaluator);
+	}
+
+	// Compiled meanings are looked up in the atlas and by
+	// the canonical form of the context first (see atlas.h
+	// and symmetry.h), since the ints of the context
+	// do not matter to them
+	ListenerPosterior listen(
+			const t_cnode& meaning,
+			const ObservedContext& observed
+		) const {
+		return listen(
+			meaning,
+			observed,
+			signatureKey(observed),
+			targetKey(observed)
+		);
+	}
+
+	ListenerPosterior listen(
+			const t_cnode& meaning,
+			const PooledContext& pooled
+		) const {
+		return listen(
+			meaning,
+			pooled.observed,
+			pooled.signatureKey,
+			pooled.targetKey
+		);
+	}
+
+	// With the canonical keys of the context already computed
+	ListenerPosterior listen(
+			const t_cnode& meaning,
+			const ObservedContext& observed,
+			const std::string& contextSignatureKey,
+			const std::string& contextTargetKey
+		) const {
+		const std::string key = cnodeToString(meaning);
+		// Sentences with no learned component may be precomputed
+		if (auto post = truthAtlas.lookup(key, observed)) {
+			return *post;
+		}
+		// Samples are not cached, since they are not exact
+		if (listenerMode == ListenerMode::MonteCarlo) {
+			return evaluateMeaning(meaning, observed);
+		}
+		const std::string sigKey = key + '|' + contextSignatureKey;
+		const std::string truthKey = key + '|' + contextTargetKey;
+		auto cached = listenerCache.find(sigKey);
+		if (!cached.has_value()) {
+			ListenerPosterior post = evaluateMeaning(meaning, observed);
+			listenerCache.insert(sigKey, CanonicalPosterior(post, observed));
+			truthCache.insert(truthKey, post.observedTrue);
+			return post;
+		}
+		ListenerPosterior post = cached->posterior(observed);
+		auto truth = truthCache.find(truthKey);
+		if (truth.has_value()) {
+			post.observedTrue = *truth;
+		} else {
+			post.observedTrue = observedTruth(*meaning, observed);
+			truthCache.insert(truthKey, post.observedTrue);
+		}
+		return post;
+	}
+
+	// Compiled meanings are evaluated in lanes or by counting,
+	// whichever is cheaper, and incrementally when counting is
+	// not allowed. Every operation of the meaning costs one word
+	// per 64 variations in lanes, and one count per configuration
+	// of the cells when counting, so the cheaper one is the one
+	// with fewer of those (whatever the size of the context)
+	ListenerPosterior evaluateMeaning(
+			const t_cnode& meaning,
+			const ObservedContext& observed
+		) const {
+		if (listenerMode == ListenerMode::Enumerate) {
+			auto post = evaluateLanes(meaning, observed);
+			if (post.has_value()) return *post;
+			IncrementalMeaning evaluator(*meaning, observed);
+			return grayCodeListener(observed, evaluator);
+		}
+		CellPartition cells = partitionContext(
+			observed, featureMask(*meaning));
+		const double laneCost = double(laneWords(std::min(observed.size(), size_t(63))));
+		if (
+			listenerMode != ListenerMode::Counts &&
+			laneCost <= cells.nConfigurations()
+		) {
+			auto post = evaluateLanes(meaning, observed);
+			if (post.has_value()) return *post;
+		}
+		if (
+			listenerMode == ListenerMode::MonteCarlo &&
+			cells.nConfigurations() > monteCarlo.budget
+		) {
+			IncrementalMeaning evaluator(*meaning, observed);
+			return monteCarloListener(observed, evaluator, monteCarlo, [&]() {
+				CountMeaning counter(*meaning, cells);
+				return countingListener(observed, cells, counter);
+			});
+		}
+		CountMeaning evaluator(*meaning, cells);
+		return countingListener(observed, cells, evaluator);
+	}
+
+	ListenerPosterior listen(
+			const t_cnode& meaning,
+			const t_context& observedC
+		) const {
+		return listen(meaning, observeContext(observedC));
+	}
+
+	void setListenerMode(ListenerMode mode) {
+		listenerMode = mode;
+	}
+
+	void setMonteCarlo(const MonteCarloSettings& settings) {
+		monteCarlo = settings;
+	}
+
 	void setHypothesis(Hyp h){
 		if (hasChosenHyp) {
 			std::cout << "WARNING: Overwriting chosen hypothesis!" << std::endl;
 		}
 		chosenHyp = h;
 		hasChosenHyp = true;
+		// A hypothesis whose meanings can be compiled
+		// defines compileSemantics
+		compiledSentences.clear();
+		if constexpr (requires (Hyp& x) { x.compileSemantics(); }) {
+			semantics = chosenHyp.compileSemantics();
+		} else {
+			semantics = std::nullopt;
+		}
+	}
+
+	// Returns the compiled meaning of a sentence
+	// under the chosen hypothesis, or nullptr if the sentence
+	// (or the hypothesis) cannot be compiled
+	t_cnode compileMeaning(const std::string& sentence) const {
+		if (!semantics.has_value()) return nullptr;
+		auto it = compiledSentences.find(sentence);
+		if (it != compiledSentences.end()) return it->second;
+		t_cnode compiled = compileSentence(sentence, *semantics);
+		compiledSentences[sentence] = compiled;
+		return compiled;
 	}
 
 	Hyp getHypothesis() const {
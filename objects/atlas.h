@@ -0,0 +1,391 @@
+# pragma once
+
+// Persistent truth atlas.
+// The truth of a sentence with no learned component (no quantifier
+// that the hypothesis defines or composes) is a fixed function of
+// the context. The atlas stores, for a given context size, the truth
+// of every such sentence up to a search depth in every target
+// variation of every canonical context (sorted multiset of
+// signatures, see symmetry.h) that generateContext can draw.
+// It is built once with --buildatlas, and main maps it read-only
+// with --atlas, so jobs skip the work and the jobs on a node
+// share the same pages.
+//
+// File layout (all integers little-endian, as written by the host):
+// - AtlasHeader
+// - for each sentence: uint32 length + compiled meaning
+//   (cnodeToString, the lookup key), uint32 length + S-expression
+// - the canonical contexts, cSize uint16 signatures each,
+//   sorted lexicographically, padded to 8 bytes
+// - the truth bits, one row of wordsPerRow uint64 per
+//   (sentence, context), in the lane layout of lanes.h:
+//   variation k gives the entity in sorted position i
+//   the target bit (k >> i) & 1
+
+const char truthAtlasMagic[8] = {'Q','A','T','L','A','S','\0','\0'};
+// Bump when the layout or the meaning of the bits changes
+const uint32_t truthAtlasVersion = 1;
+
+struct AtlasHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t cSize;
+	uint32_t nSentences;
+	uint32_t nContexts;
+	// Number of lexical features and range of the ints
+	// the atlas was built for
+	uint32_t nFeatures;
+	int32_t maxAbs;
+	uint64_t wordsPerRow;
+	uint64_t keysOffset;
+	uint64_t contextsOffset;
+	uint64_t bitsOffset;
+	uint64_t fileSize;
+};
+
+// Range of the ints drawn by generateContext for a context size
+int contextIntRange(size_t cSize) {
+	return std::max(10, (int(cSize) - 1) / 2 + 1);
+}
+
+// Every sorted multiset of cSize signatures that a context
+// of unique ints in [-maxAbs, maxAbs] can have,
+// in lexicographic order
+std::vector<std::vector<t_signature>> canonicalContexts(
+		size_t cSize,
+		int maxAbs
+	) {
+
+	// how many ints have each signature
+	std::map<t_signature, size_t> available;
+	for (int i = -maxAbs; i <= maxAbs; i++) {
+		available[featureSignature(i)]++;
+	}
+	std::vector<std::pair<t_signature, size_t>> classes(
+		available.begin(), available.end());
+
+	std::vector<std::vector<t_signature>> contexts;
+	std::vector<t_signature> current;
+	std::function<void(size_t)> extend = [&](size_t first) {
+		if (current.size() == cSize) {
+			contexts.push_back(current);
+			return;
+		}
+		for (size_t c = first; c < classes.size(); c++) {
+			size_t used = std::count(
+				current.begin(), current.end(), classes[c].first);
+			if (used == classes[c].second) continue;
+			current.push_back(classes[c].first);
+			extend(c);
+			current.pop_back();
+		}
+	};
+	extend(0);
+	return contexts;
+}
+
+// Sentences with no learned component compile without
+// any quantifier and without a composition rule
+bool isHypothesisIndependent(const std::string& sentence) {
+	return compileSentence(sentence, CompiledSemantics{nullptr, {}}) != nullptr;
+}
+
+// Truth of a compiled meaning in every variation, in lanes
+std::vector<uint64_t> truthBits(
+		const CNode& meaning,
+		const ObservedContext& oc
+	) {
+	const size_t N = oc.size();
+	std::vector<uint64_t> bits(laneWords(N), 0);
+	IncrementalMeaning evaluator(meaning, oc);
+	uint64_t k = 0;
+	for (uint64_t g = 0; g < (uint64_t(1) << N); g++) {
+		if (g > 0) {
+			size_t j = std::countr_zero(g);
+			k ^= uint64_t(1) << j;
+			evaluator.flip(j, (k >> j) & 1);
+		}
+		std::optional<bool> v = evaluator.value();
+		if (v.has_value() && *v) bits[k/64] |= uint64_t(1) << (k%64);
+	}
+	return bits;
+}
+
+template <typename Hyp>
+class Agent;
+
+template <typename T>
+void writeBinary(std::ofstream& file, const T& value) {
+	file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+void writeString(std::ofstream& file, const std::string& s) {
+	writeBinary(file, uint32_t(s.size()));
+	file.write(s.data(), s.size());
+}
+
+void padTo8(std::ofstream& file) {
+	while (file.tellp() % 8 != 0) file.put('\0');
+}
+
+// The offline tool. Enumerates the sentences of the hypothesis'
+// grammar up to searchDepth, keeps the hypothesis-independent ones,
+// and writes the atlas for contexts of size cSize.
+// The file is written next to path and renamed at the end,
+// so jobs never map a half-written atlas.
+template <typename Hyp>
+void buildTruthAtlas(
+		const std::string& path,
+		size_t cSize,
+		size_t searchDepth,
+		const Hyp& h
+	) {
+
+	if (cSize > maxLaneContextSize) {
+		throw std::runtime_error(
+			"Context size too large for an atlas: " + std::to_string(cSize));
+	}
+
+	Agent<Hyp> agent{h};
+	Hyp hyp = agent.getHypothesis();
+	LexicalSemantics lex = hyp.getLexicon();
+	t_terminalsMap terminalsMap = agent.generateTerminalsMap(lex);
+	auto sentences = agent.enumerateSentences(
+		hyp.getCompositionF(), lex, terminalsMap, searchDepth);
+
+	// Sentences with the same meaning only need one row
+	std::vector<std::string> sExprs;
+	std::vector<t_cnode> meanings;
+	std::set<std::string> keys;
+	for (auto& s : sentences) {
+		std::string sExpr = s->toSExpression();
+		if (!isHypothesisIndependent(sExpr)) continue;
+		t_cnode m = compileSentence(sExpr, CompiledSemantics{nullptr, {}});
+		if (keys.insert(cnodeToString(m)).second) {
+			sExprs.push_back(sExpr);
+			meanings.push_back(m);
+		}
+	}
+
+	const int maxAbs = contextIntRange(cSize);
+	auto contexts = canonicalContexts(cSize, maxAbs);
+
+	AtlasHeader header{};
+	std::copy(truthAtlasMagic, truthAtlasMagic + 8, header.magic);
+	header.version = truthAtlasVersion;
+	header.cSize = cSize;
+	header.nSentences = meanings.size();
+	header.nContexts = contexts.size();
+	header.nFeatures = lexicalFeatures.size();
+	header.maxAbs = maxAbs;
+	header.wordsPerRow = laneWords(cSize);
+
+	const std::string tmpPath = path + ".tmp";
+	std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+	if (!file) throw std::runtime_error("Cannot write " + tmpPath);
+
+	// the header is written again at the end with the offsets
+	writeBinary(file, header);
+	header.keysOffset = file.tellp();
+	for (size_t s = 0; s < meanings.size(); s++) {
+		writeString(file, cnodeToString(meanings[s]));
+		writeString(file, sExprs[s]);
+	}
+	padTo8(file);
+	header.contextsOffset = file.tellp();
+	for (auto& sigs : contexts) {
+		file.write(
+			reinterpret_cast<const char*>(sigs.data()),
+			sigs.size()*sizeof(t_signature));
+	}
+	padTo8(file);
+	header.bitsOffset = file.tellp();
+	for (size_t s = 0; s < meanings.size(); s++) {
+		for (auto& sigs : contexts) {
+			ObservedContext oc;
+			oc.signatures = sigs;
+			oc.ints.assign(sigs.size(), 0);
+			oc.targets.assign(sigs.size(), 0);
+			auto bits = truthBits(*meanings[s], oc);
+			file.write(
+				reinterpret_cast<const char*>(bits.data()),
+				bits.size()*sizeof(uint64_t));
+		}
+	}
+	header.fileSize = file.tellp();
+	file.seekp(0);
+	writeBinary(file, header);
+	file.close();
+	if (!file) throw std::runtime_error("Error writing " + tmpPath);
+	std::filesystem::rename(tmpPath, path);
+
+	std::cout
+		<< "Atlas: " << meanings.size() << " sentences, "
+		<< contexts.size() << " contexts of size " << cSize
+		<< " in " << path << std::endl;
+}
+
+// A read-only mapping of an atlas file
+class TruthAtlas {
+private:
+
+	const char* data = nullptr;
+	size_t size = 0;
+	const AtlasHeader* header = nullptr;
+	// row of each compiled meaning
+	std::unordered_map<std::string, uint32_t> sentences;
+
+	const t_signature* context(size_t c) const {
+		return reinterpret_cast<const t_signature*>(
+			data + header->contextsOffset) + c*header->cSize;
+	}
+
+	const uint64_t* row(size_t s, size_t c) const {
+		return reinterpret_cast<const uint64_t*>(data + header->bitsOffset)
+			+ (s*header->nContexts + c)*header->wordsPerRow;
+	}
+
+	// Index of a canonical context, by binary search
+	std::optional<size_t> findContext(
+			const std::vector<t_signature>& sigs
+		) const {
+		size_t lo = 0, hi = header->nContexts;
+		while (lo < hi) {
+			size_t mid = (lo + hi)/2;
+			const t_signature* m = context(mid);
+			if (std::lexicographical_compare(
+					m, m + header->cSize, sigs.begin(), sigs.end())) {
+				lo = mid + 1;
+			} else {
+				hi = mid;
+			}
+		}
+		if (lo < header->nContexts &&
+				std::equal(sigs.begin(), sigs.end(), context(lo))) {
+			return lo;
+		}
+		return std::nullopt;
+	}
+
+public:
+
+	TruthAtlas() = default;
+	TruthAtlas(const TruthAtlas&) = delete;
+	TruthAtlas& operator=(const TruthAtlas&) = delete;
+
+	~TruthAtlas() {
+		if (data) munmap(const_cast<char*>(data), size);
+	}
+
+	// Maps the atlas. Files of another version, lexicon
+	// or context size are refused.
+	void load(const std::string& path, size_t cSize) {
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) throw std::runtime_error("Cannot open atlas " + path);
+		struct stat st;
+		fstat(fd, &st);
+		size = st.st_size;
+		if (size < sizeof(AtlasHeader)) {
+			close(fd);
+			throw std::runtime_error("Truncated atlas " + path);
+		}
+		void* mapped = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (mapped == MAP_FAILED) {
+			throw std::runtime_error("Cannot map atlas " + path);
+		}
+		data = static_cast<const char*>(mapped);
+		header = reinterpret_cast<const AtlasHeader*>(data);
+
+		std::string problem;
+		if (!std::equal(truthAtlasMagic, truthAtlasMagic + 8, header->magic)) {
+			problem = "not an atlas";
+		} else if (header->version != truthAtlasVersion) {
+			problem = "version " + std::to_string(header->version);
+		} else if (header->fileSize != size) {
+			problem = "truncated";
+		} else if (header->nFeatures != lexicalFeatures.size() ||
+				header->maxAbs != contextIntRange(cSize)) {
+			problem = "built for another lexicon";
+		} else if (header->cSize != cSize) {
+			problem = "built for context size " + std::to_string(header->cSize);
+		}
+		if (!problem.empty()) {
+			munmap(mapped, size);
+			data = nullptr;
+			header = nullptr;
+			throw std::runtime_error("Cannot use atlas " + path + ": " + problem);
+		}
+
+		const char* p = data + header->keysOffset;
+		auto readString = [&p]() {
+			uint32_t length;
+			std::memcpy(&length, p, sizeof(length));
+			std::string s(p + sizeof(length), length);
+			p += sizeof(length) + length;
+			return s;
+		};
+		for (uint32_t s = 0; s < header->nSentences; s++) {
+			std::string key = readString();
+			readString();
+			sentences[key] = s;
+		}
+	}
+
+	bool loaded() const { return header != nullptr; }
+
+	size_t nSentences() const { return sentences.size(); }
+
+	// The exact listener posterior of a compiled meaning,
+	// if the atlas has it
+	std::optional<ListenerPosterior> lookup(
+			const std::string& key,
+			const ObservedContext& oc
+		) const {
+
+		if (!loaded() || oc.size() != header->cSize) return std::nullopt;
+		auto s = sentences.find(key);
+		if (s == sentences.end()) return std::nullopt;
+
+		// sorted position of each entity
+		const size_t N = oc.size();
+		std::vector<size_t> order(N);
+		std::iota(order.begin(), order.end(), 0);
+		std::stable_sort(order.begin(), order.end(),
+			[&oc](size_t a, size_t b) {
+				return oc.signatures[a] < oc.signatures[b];
+			});
+		std::vector<t_signature> sigs(N);
+		std::vector<size_t> position(N);
+		for (size_t i = 0; i < N; i++) {
+			sigs[i] = oc.signatures[order[i]];
+			position[order[i]] = i;
+		}
+		auto c = findContext(sigs);
+		if (!c.has_value()) return std::nullopt;
+
+		const uint64_t* bits = row(s->second, *c);
+		const size_t W = header->wordsPerRow;
+		ListenerPosterior post;
+		uint64_t nTrue = 0;
+		for (size_t w = 0; w < W; w++) {
+			nTrue += std::popcount(bits[w] & validLanes(N, w));
+		}
+		post.nTrue = nTrue;
+		post.nVariations = std::ldexp(1.0, N);
+		uint64_t observed = 0;
+		for (size_t j = 0; j < N; j++) {
+			uint64_t count = 0;
+			for (size_t w = 0; w < W; w++) {
+				count += std::popcount(bits[w] & targetLanes(position[j], w));
+			}
+			post.marginals.push_back((double)count/nTrue);
+			observed |= uint64_t(oc.targets[j]) << position[j];
+		}
+		post.observedTrue = (bits[observed/64] >> (observed%64)) & 1;
+		return post;
+	}
+};
+
+// The atlas of the run, if any. Only load it at startup.
+TruthAtlas truthAtlas;
@@ -0,0 +1,164 @@
+# pragma once
+
+// Checkpoints of long runs.
+// The state of a run (chains, random number generators,
+// context pools, TopN, frontier, and how far the output files got)
+// is written every --checkpointevery seconds, and when SLURM
+// sends SIGTERM (before killing the job) or SIGUSR1, to
+// the file `checkpoint` in the run folder. --resume continues
+// from it, and the run goes on exactly as it would have without
+// the interruption.
+// The file is written to a temporary file first and then renamed,
+// so a kill while writing leaves the previous checkpoint intact.
+//
+// NOTE: this only covers the chains of this project, i.e.
+// --speculative, --screen and --weights. The chains of Fleet's
+// ParallelTempering keep their state (and Fleet's random number
+// generators) inside Fleet, where it cannot be saved from here.
+
+// Where checkpoints go (empty is no checkpoints),
+// and seconds between them (0 is only on signals)
+std::filesystem::path checkpointPath;
+double checkpointEvery = 0;
+// Whether the run continues from checkpointPath
+bool resumeRun = false;
+
+// The last signal asking for a checkpoint (0 is none)
+std::atomic<int> checkpointSignal{0};
+
+extern "C" void onCheckpointSignal(int sig) {
+	checkpointSignal = sig;
+}
+
+void installCheckpointSignals() {
+	std::signal(SIGTERM, onCheckpointSignal);
+	std::signal(SIGUSR1, onCheckpointSignal);
+}
+
+// Whether a signal asked for a checkpoint. Chains stop at
+// their next step when it does, so that the run checkpoints
+// at once instead of at the end of the round
+bool checkpointRequested() {
+	return !checkpointPath.empty() && checkpointSignal != 0;
+}
+
+// Values are written one per line. Doubles are written
+// as their bits, so that they are read back exactly
+// (including infinities and NaNs)
+void writeValue(std::ostream& os, double x) {
+	os << std::bit_cast<uint64_t>(x) << "\n";
+}
+void writeValue(std::ostream& os, uint64_t x) {
+	os << x << "\n";
+}
+void writeValue(std::ostream& os, const std::string& s) {
+	assert(s.find('\n') == std::string::npos);
+	os << s << "\n";
+}
+template <typename Engine>
+void writeEngine(std::ostream& os, const Engine& e) {
+	os << e << "\n";
+}
+
+// Every read takes a whole line
+std::string readString(std::istream& is) {
+	std::string s;
+	std::getline(is, s);
+	return s;
+}
+uint64_t readSize(std::istream& is) {
+	std::string s = readString(is);
+	return s.empty() ? 0 : std::stoull(s);
+}
+double readDouble(std::istream& is) {
+	return std::bit_cast<double>(readSize(is));
+}
+template <typename Engine>
+void readEngine(std::istream& is, Engine& e) {
+	std::istringstream line(readString(is));
+	line >> e;
+}
+
+void writeContext(std::ostream& os, const t_context& c) {
+	writeValue(os, uint64_t(c.size()));
+	for (auto& [i, target] : c) {
+		os << i << " " << target << "\n";
+	}
+}
+t_context readContext(std::istream& is) {
+	t_context c;
+	size_t n = readSize(is);
+	for (size_t k = 0; k < n; k++) {
+		std::istringstream line(readString(is));
+		int i;
+		bool target;
+		line >> i >> target;
+		c.insert(std::make_tuple(i, target));
+	}
+	return c;
+}
+
+// Writes a checkpoint atomically
+void writeCheckpoint(
+		const std::filesystem::path& path,
+		const std::function<void(std::ostream&)>& save
+	) {
+	std::filesystem::path tmp = path;
+	tmp += ".tmp";
+	{
+		std::ofstream file(tmp);
+		save(file);
+		file.flush();
+		if (!file) {
+			throw std::runtime_error("Could not write checkpoint " + tmp.string());
+		}
+	}
+	std::filesystem::rename(tmp, path);
+}
+
+void readCheckpoint(
+		const std::filesystem::path& path,
+		const std::function<void(std::istream&)>& load
+	) {
+	std::ifstream file(path);
+	if (!file) {
+		throw std::runtime_error("No checkpoint to resume from in " + path.string());
+	}
+	load(file);
+	if (!file) {
+		throw std::runtime_error("Corrupt checkpoint " + path.string());
+	}
+}
+
+// Decides when a run checkpoints, between two rounds of its
+// chains, or in the middle of one after a signal
+class CheckpointTimer {
+private:
+	std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+public:
+	// Whether to checkpoint now
+	bool due() const {
+		if (checkpointPath.empty()) return false;
+		if (checkpointRequested()) return true;
+		std::chrono::duration<double> elapsed =
+			std::chrono::steady_clock::now() - last;
+		return checkpointEvery > 0 && elapsed.count() >= checkpointEvery;
+	}
+	// After a checkpoint: whether the run must stop now
+	bool done() {
+		last = std::chrono::steady_clock::now();
+		int sig = checkpointSignal.exchange(0);
+		return sig == SIGTERM;
+	}
+};
+
+// Output files are cut back to their size at the checkpoint
+// when resuming, so that lines are not written twice
+void writeFileSize(std::ostream& os, const std::filesystem::path& p) {
+	writeValue(os, uint64_t(
+		std::filesystem::exists(p) ? std::filesystem::file_size(p) : 0));
+}
+void restoreFileSize(std::istream& is, const std::filesystem::path& p) {
+	uint64_t size = readSize(is);
+	if (std::filesystem::exists(p)) std::filesystem::resize_file(p, size);
+}
@@ -0,0 +1,380 @@
+# pragma once
+
+// Compiled meanings.
+// Every meaning that can be built from the lexicon
+// and from the QuantsGrammar (apart from nTh and the TVs)
+// only looks at the entities through the lexicalFeatures,
+// the target bit, and cardinalities of sets of entities.
+// Such meanings can be compiled into a small expression tree
+// that can be evaluated without going through the closures,
+// e.g. over many target variations at the same time.
+// Meanings that cannot be compiled keep using the closures.
+
+enum class CMOp : uint8_t {
+	// -> set of entities
+	Feature,		// value: index in lexicalFeatures
+	Target,
+	Distractor,
+	Universe,
+	Union,
+	Intersection,
+	Setminus,
+	// Arguments of a quantifier or of a composition rule
+	ArgL,
+	ArgR,
+	// -> int
+	Const,			// value: the constant
+	Card,
+	Plus,
+	Minus,
+	// -> bool
+	BoolConst,		// value: 0 or 1
+	IntEq,
+	IntGt,
+	Not,
+	And,
+	Or,
+	IfElse,
+	// Undefined (presupposition failure) unless kids[0] holds,
+	// otherwise kids[1]
+	Presup,
+	// In a composition rule: apply the quantifier being
+	// composed to kids[0] and kids[1]
+	QApply
+};
+
+struct CNode;
+using t_cnode = std::shared_ptr<const CNode>;
+
+struct CNode {
+	CMOp op;
+	int value = 0;
+	std::vector<t_cnode> kids;
+};
+
+t_cnode cnode(CMOp op, std::vector<t_cnode> kids = {}, int value = 0) {
+	return std::make_shared<const CNode>(CNode{op, value, std::move(kids)});
+}
+
+// Types of the values the nodes evaluate to
+enum class CMType { Set, Int, Bool };
+
+CMType cnodeType(const CNode& n) {
+	switch (n.op) {
+		case CMOp::Feature: case CMOp::Target: case CMOp::Distractor:
+		case CMOp::Universe: case CMOp::Union: case CMOp::Intersection:
+		case CMOp::Setminus: case CMOp::ArgL: case CMOp::ArgR:
+			return CMType::Set;
+		case CMOp::Const: case CMOp::Card:
+		case CMOp::Plus: case CMOp::Minus:
+			return CMType::Int;
+		default:
+			return CMType::Bool;
+	}
+}
+
+std::string cmopToString(CMOp op) {
+	switch (op) {
+		case CMOp::Feature: 		return "f";
+		case CMOp::Target: 			return "target";
+		case CMOp::Distractor: 		return "distractor";
+		case CMOp::Universe: 		return "universe";
+		case CMOp::Union: 			return "union";
+		case CMOp::Intersection: 	return "intersection";
+		case CMOp::Setminus: 		return "setminus";
+		case CMOp::ArgL: 			return "L";
+		case CMOp::ArgR: 			return "R";
+		case CMOp::Const: 			return "#";
+		case CMOp::Card: 			return "card";
+		case CMOp::Plus: 			return "+";
+		case CMOp::Minus: 			return "-";
+		case CMOp::BoolConst: 		return "b";
+		case CMOp::IntEq: 			return "intEq";
+		case CMOp::IntGt: 			return "intGt";
+		case CMOp::Not: 			return "not";
+		case CMOp::And: 			return "and";
+		case CMOp::Or: 				return "or";
+		case CMOp::IfElse: 			return "ifElse";
+		case CMOp::Presup: 			return "presup";
+		case CMOp::QApply: 			return "Q";
+	}
+	return "?";
+}
+
+// Unambiguous string representation of a compiled meaning.
+// Two meanings with the same string are the same meaning,
+// so this is used as a cache key.
+std::string cnodeToString(const t_cnode& n) {
+	std::string out;
+	bool hasValue =
+		n->op == CMOp::Feature ||
+		n->op == CMOp::Const ||
+		n->op == CMOp::BoolConst;
+	if (n->kids.empty()) {
+		out = cmopToString(n->op);
+		if (hasValue) out += std::to_string(n->value);
+		return out;
+	}
+	out = "(" + cmopToString(n->op);
+	for (auto& k : n->kids) {
+		out += " " + cnodeToString(k);
+	}
+	return out + ")";
+}
+
+// Replaces ArgL and ArgR with l and r.
+// QApply nodes are replaced by the quantifier q
+// applied to their (substituted) arguments.
+t_cnode substitute(
+		const t_cnode& n,
+		const t_cnode& l,
+		const t_cnode& r,
+		const t_cnode& q = nullptr
+	) {
+	if (n->op == CMOp::ArgL) return l;
+	if (n->op == CMOp::ArgR) return r;
+	if (n->kids.empty()) return n;
+	std::vector<t_cnode> kids;
+	for (auto& k : n->kids) {
+		kids.push_back(substitute(k, l, r, q));
+	}
+	if (n->op == CMOp::QApply) {
+		if (!q) throw std::runtime_error("QApply without a quantifier");
+		return substitute(q, kids[0], kids[1]);
+	}
+	return cnode(n->op, kids, n->value);
+}
+
+// Whether the meaning contains a node with the given op
+bool cnodeContains(const t_cnode& n, CMOp op) {
+	if (n->op == op) return true;
+	for (auto& k : n->kids) {
+		if (cnodeContains(k, op)) return true;
+	}
+	return false;
+}
+
+///// Built-in quantifiers, as functions of ArgL and ArgR
+
+t_cnode cnodeEvery() {
+	return cnode(CMOp::IntEq, {
+		cnode(CMOp::Card, {
+			cnode(CMOp::Setminus, {cnode(CMOp::ArgL), cnode(CMOp::ArgR)})
+		}),
+		cnode(CMOp::Const, {}, 0)
+	});
+}
+
+t_cnode cnodeSome() {
+	return cnode(CMOp::IntGt, {
+		cnode(CMOp::Card, {
+			cnode(CMOp::Intersection, {cnode(CMOp::ArgL), cnode(CMOp::ArgR)})
+		}),
+		cnode(CMOp::Const, {}, 0)
+	});
+}
+
+t_cnode cnodeThe() {
+	return cnode(CMOp::Presup, {
+		cnode(CMOp::IntEq, {
+			cnode(CMOp::Card, {cnode(CMOp::ArgL)}),
+			cnode(CMOp::Const, {}, 1)
+		}),
+		cnodeSome()
+	});
+}
+
+// What a hypothesis tells the compiler about its part of the language
+struct CompiledSemantics {
+	// How nodes [Q IV] are composed, as a function of
+	// QApply, ArgL (the IV sister of Q) and ArgR
+	// (the IV the resulting DP applies to).
+	// nullptr means plain function application.
+	t_cnode compRule = nullptr;
+	// Quantifiers in the lexicon, as functions of ArgL and ArgR
+	std::map<std::string, t_cnode> quantifiers = {
+		{"every", cnodeEvery()},
+		{"some", cnodeSome()},
+		{"the", cnodeThe()}
+	};
+};
+
+// Intermediate values while compiling a sentence
+struct CompileValue {
+	enum class Kind { Bool, Set, DP, Quant, Connective } kind;
+	// Bool and Set: the node. Quant and DP: the quantifier.
+	t_cnode node;
+	// DP: the IV sister of the quantifier
+	t_cnode restrictor;
+	// DP: whether it was built by composing [Q IV]
+	bool composed = false;
+	// Connective: the operator, how many arguments it
+	// takes, and the ones it has received so far
+	CMOp op = CMOp::Not;
+	size_t arity = 0;
+	std::vector<t_cnode> args;
+};
+
+std::optional<CompileValue> compileLeaf(
+		const std::string& name,
+		const CompiledSemantics& sem
+	) {
+
+	using Kind = CompileValue::Kind;
+
+	for (size_t i = 0; i < lexicalFeatures.size(); i++) {
+		if (lexicalFeatures[i] == name) {
+			return CompileValue{Kind::Set, cnode(CMOp::Feature, {}, i)};
+		}
+	}
+	if (name == "target") {
+		return CompileValue{Kind::Set, cnode(CMOp::Target)};
+	}
+	if (name == "distractor") {
+		return CompileValue{Kind::Set, cnode(CMOp::Distractor)};
+	}
+	if (name == "something") {
+		return CompileValue{Kind::DP, cnodeSome(), cnode(CMOp::Universe)};
+	}
+	if (name == "everything") {
+		return CompileValue{Kind::DP, cnodeEvery(), cnode(CMOp::Universe)};
+	}
+	if (name == "true" || name == "false") {
+		return CompileValue{
+			Kind::Bool, cnode(CMOp::BoolConst, {}, name == "true")};
+	}
+	CompileValue connective{Kind::Connective};
+	if (name == "l_not") {
+		connective.op = CMOp::Not;
+		connective.arity = 1;
+		return connective;
+	}
+	if (name == "l_and" || name == "l_or") {
+		connective.op = name == "l_and" ? CMOp::And : CMOp::Or;
+		connective.arity = 2;
+		return connective;
+	}
+	if (name == "l_if_else") {
+		connective.op = CMOp::IfElse;
+		connective.arity = 3;
+		return connective;
+	}
+	auto q = sem.quantifiers.find(name);
+	if (q != sem.quantifiers.end()) {
+		return CompileValue{Kind::Quant, q->second};
+	}
+	// e.g., the TVs
+	return std::nullopt;
+}
+
+std::optional<CompileValue> compileApplication(
+		const CompileValue& f,
+		const CompileValue& arg,
+		const CompiledSemantics& sem
+	) {
+
+	using Kind = CompileValue::Kind;
+
+	if (f.kind == Kind::Quant && arg.kind == Kind::Set) {
+		CompileValue dp{Kind::DP, f.node, arg.node};
+		dp.composed = sem.compRule != nullptr;
+		return dp;
+	}
+	if (f.kind == Kind::DP && arg.kind == Kind::Set) {
+		t_cnode out = f.composed ?
+			substitute(sem.compRule, f.restrictor, arg.node, f.node) :
+			substitute(f.node, f.restrictor, arg.node);
+		return CompileValue{Kind::Bool, out};
+	}
+	if (f.kind == Kind::Connective && arg.kind == Kind::Bool) {
+		CompileValue out = f;
+		out.args.push_back(arg.node);
+		if (out.args.size() == out.arity) {
+			return CompileValue{Kind::Bool, cnode(out.op, out.args)};
+		}
+		return out;
+	}
+	return std::nullopt;
+}
+
+std::optional<CompileValue> compileSExpression(
+		std::istringstream& ss,
+		const CompiledSemantics& sem
+	) {
+
+	std::string token;
+	ss >> token;
+	if (token == "(") {
+		auto left = compileSExpression(ss, sem);
+		auto right = compileSExpression(ss, sem);
+		// Consume the closing ')'
+		ss >> token;
+		if (!left || !right || token != ")") {
+			return std::nullopt;
+		}
+		return compileApplication(*left, *right, sem);
+	}
+	return compileLeaf(token, sem);
+}
+
+// Compiles a sentence (as an S-expression of lexical entries)
+// of type <s,t>. Returns nullptr if the sentence
+// cannot be compiled.
+t_cnode compileSentence(
+		const std::string& sExpr,
+		const CompiledSemantics& sem
+	) {
+	std::istringstream ss(sExpr);
+	auto value = compileSExpression(ss, sem);
+	if (!value || value->kind != CompileValue::Kind::Bool) {
+		return nullptr;
+	}
+	return value->node;
+}
+
+///// Reading programs serialized by Fleet
+
+// A node of a serialized Fleet program,
+// i.e. "nt:format" with one child per "%s" in the format
+struct ProgramNode {
+	int nt;
+	std::string format;
+	std::vector<ProgramNode> kids;
+};
+
+ProgramNode parseProgramNode(
+		const std::vector<std::string>& entries,
+		size_t& pos
+	) {
+	if (pos >= entries.size()) {
+		throw std::runtime_error("Truncated serialized program");
+	}
+	const std::string& entry = entries[pos++];
+	size_t colon = entry.find(':');
+	if (colon == std::string::npos) {
+		throw std::runtime_error("Malformed program entry: " + entry);
+	}
+	ProgramNode node{std::stoi(entry.substr(0, colon)), entry.substr(colon+1)};
+	size_t nKids = 0;
+	for (size_t i = node.format.find("%s"); i != std::string::npos;
+			i = node.format.find("%s", i+2)) {
+		nKids++;
+	}
+	for (size_t i = 0; i < nKids; i++) {
+		node.kids.push_back(parseProgramNode(entries, pos));
+	}
+	return node;
+}
+
+// Parses the output of Hypothesis::serialize(),
+// e.g. "1:%s | %s;3:( %s %s );..."
+ProgramNode parseSerializedProgram(const std::string& serialized) {
+	std::vector<std::string> entries;
+	std::stringstream ss(serialized);
+	std::string entry;
+	while (std::getline(ss, entry, ';')) {
+		entries.push_back(entry);
+	}
+	size_t pos = 0;
+	return parseProgramNode(entries, pos);
+}
@@ -0,0 +1,120 @@
+# pragma once
+
+// Pool of contexts for the likelihood.
+// Drawing fresh contexts for every likelihood evaluation means
+// that the current and the proposed hypotheses are compared
+// on different random data, and everything derived from the
+// contexts is recomputed every time. Instead, each chain keeps
+// a pool of contexts and replaces a slice of it every few
+// evaluations, so that hypotheses evaluated close in time
+// see the same contexts and the same speaker randomness
+// (common random numbers), and the pool still moves on.
+
+// A context with everything derived from it
+// that does not depend on the hypothesis
+struct PooledContext {
+	t_context context;
+	ObservedContext observed;
+	// canonical keys (see symmetry.h)
+	std::string signatureKey;
+	std::string targetKey;
+	// seed of the speaker's random choice in this context,
+	// so that it does not depend on what happened in
+	// other contexts, nor on the order they are visited in
+	uint32_t seed = 0;
+};
+
+PooledContext poolContext(const t_context& c, uint32_t seed = 0) {
+	PooledContext p{c, observeContext(c)};
+	p.signatureKey = signatureKey(p.observed);
+	p.targetKey = targetKey(p.observed);
+	p.seed = seed;
+	return p;
+}
+
+std::vector<PooledContext> poolContexts(const std::vector<t_context>& cs) {
+	std::vector<PooledContext> pooled;
+	for (auto& c : cs) pooled.push_back(poolContext(c));
+	return pooled;
+}
+
+class ContextPool {
+private:
+
+	size_t cSize;
+	size_t nObs;
+	// a slice is refreshed every refreshEvery draws (0 is never)
+	size_t refreshEvery;
+	size_t sliceSize;
+	std::mt19937 rng;
+	std::vector<PooledContext> contexts;
+	size_t draws = 0;
+	// first context of the next slice to refresh
+	size_t nextSlice = 0;
+	// slices refreshed so far
+	size_t nRefreshes = 0;
+
+	PooledContext fresh() {
+		t_context c = generateContext(cSize, rng);
+		return poolContext(c, rng());
+	}
+
+public:
+
+	ContextPool(
+			size_t cSize,
+			size_t nObs,
+			uint64_t seed,
+			size_t refreshEvery,
+			size_t sliceSize
+		) : cSize(cSize), nObs(nObs), refreshEvery(refreshEvery),
+			sliceSize(std::clamp(sliceSize, size_t(1), std::max(nObs, size_t(1)))),
+			rng(seed) {
+		for (size_t i = 0; i < nObs; i++) {
+			contexts.push_back(fresh());
+		}
+	}
+
+	size_t contextSize() const { return cSize; }
+	size_t size() const { return nObs; }
+	// Changes whenever the contexts do
+	size_t generation() const { return nRefreshes; }
+
+	// For checkpoints (see checkpoint.h).
+	// The size and the refresh schedule come from the options
+	void save(std::ostream& os) const {
+		writeEngine(os, rng);
+		writeValue(os, uint64_t(draws));
+		writeValue(os, uint64_t(nextSlice));
+		writeValue(os, uint64_t(nRefreshes));
+		for (auto& p : contexts) {
+			writeContext(os, p.context);
+			writeValue(os, uint64_t(p.seed));
+		}
+	}
+
+	void load(std::istream& is) {
+		readEngine(is, rng);
+		draws = readSize(is);
+		nextSlice = readSize(is);
+		nRefreshes = readSize(is);
+		for (auto& p : contexts) {
+			t_context c = readContext(is);
+			p = poolContext(c, readSize(is));
+		}
+	}
+
+	// The contexts for one likelihood evaluation.
+	// The reference stays valid until the next call.
+	const std::vector<PooledContext>& next() {
+		if (refreshEvery > 0 && draws > 0 && draws % refreshEvery == 0) {
+			for (size_t i = 0; i < sliceSize && nObs > 0; i++) {
+				contexts[nextSlice] = fresh();
+				nextSlice = (nextSlice + 1) % nObs;
+			}
+			nRefreshes++;
+		}
+		draws++;
+		return contexts;
+	}
+};
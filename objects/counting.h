@@ -0,0 +1,297 @@
+# pragma once
+
+// Exact listener for large contexts.
+// Every meaning in the lexicon only sees the features of an entity
+// (its signature) and whether it is a target, so meanings are
+// invariant to permutations of entities with the same signature.
+// Then the truth of a sentence in a target variation only depends on
+// how many targets there are in each cell of entities with the
+// same signature, and the 2^N variations can be replaced by
+// the prod_c (n_c + 1) target counts, each weighted by the number of
+// variations that have those counts, prod_c binom(n_c, t_c).
+// This is polynomial in N for a fixed number of cells.
+// Compiled meanings are invariant by construction. Closures are
+// only counted when the hypothesis declares permutationInvariant,
+// since primitives like nTh or getEntity depend on the order
+// of the entities (see Agent::listen).
+
+// How the listener goes through the target variations
+enum class ListenerMode {
+	// The cheapest exact method: lanes or counting for
+	// compiled meanings, Gray-code enumeration or counting
+	// for closures, sampling when none fits
+	Auto,
+	// Always visit every variation
+	Enumerate,
+	// Always count the meanings that can be counted
+	Counts,
+	// Sample variations when exact methods exceed
+	// the sampling budget (see montecarlo.h)
+	MonteCarlo
+};
+
+// The listener mode of new agents.
+// Only change it at startup, like the kernels.
+ListenerMode defaultListenerMode = ListenerMode::Auto;
+
+// Selects the listener mode by name
+// ("auto", "enumerate", "counts", "montecarlo")
+void setListenerMode(const std::string& name) {
+	static const std::map<std::string, ListenerMode> names = {
+		{"auto", ListenerMode::Auto},
+		{"enumerate", ListenerMode::Enumerate},
+		{"counts", ListenerMode::Counts},
+		{"montecarlo", ListenerMode::MonteCarlo}
+	};
+	auto it = names.find(name);
+	if (it == names.end()) {
+		throw std::runtime_error("Unknown listener mode: " + name);
+	}
+	defaultListenerMode = it->second;
+}
+
+// Partition of the entities of a context into cells
+// of entities with the same signature
+struct CellPartition {
+	// signature (restricted to the relevant features) of each cell
+	std::vector<t_signature> signatures;
+	// entities in each cell
+	std::vector<std::vector<size_t>> entities;
+	// cell of each entity
+	std::vector<size_t> cellOf;
+
+	size_t size() const { return signatures.size(); }
+
+	// Number of target count configurations to visit
+	double nConfigurations() const {
+		double n = 1;
+		for (auto& e : entities) n *= e.size() + 1;
+		return n;
+	}
+};
+
+// Only the features in mask are used to tell entities apart,
+// so meanings that only look at a few features have few cells
+CellPartition partitionContext(
+		const ObservedContext& oc,
+		t_signature mask = ~t_signature(0)
+	) {
+	CellPartition cells;
+	std::map<t_signature, size_t> index;
+	for (size_t j = 0; j < oc.size(); j++) {
+		t_signature sig = oc.signatures[j] & mask;
+		auto [it, inserted] = index.try_emplace(sig, cells.size());
+		if (inserted) {
+			cells.signatures.push_back(sig);
+			cells.entities.push_back({});
+		}
+		cells.entities[it->second].push_back(j);
+		cells.cellOf.push_back(it->second);
+	}
+	return cells;
+}
+
+// Features that a compiled meaning looks at
+t_signature featureMask(const CNode& n) {
+	t_signature mask = 0;
+	if (n.op == CMOp::Feature) mask |= t_signature(1) << n.value;
+	for (auto& k : n.kids) mask |= featureMask(*k);
+	return mask;
+}
+
+// Compiled meaning evaluated on the target counts of each cell.
+// Sets are precomputed once as the kinds of entity they contain,
+// where the kind of an entity is its cell and its target bit,
+// and cardinalities are sums of counts over kinds.
+class CountMeaning : public FlatMeaning {
+private:
+
+	const CellPartition& cells;
+	// Card slots: the kinds (2*cell + target bit) in the set
+	std::vector<std::vector<size_t>> cardKinds;
+
+	// Membership of each kind in a set slot
+	std::vector<uint8_t> kinds(
+			const Slot& s,
+			const std::vector<std::vector<uint8_t>>& members
+		) const {
+		const size_t K = 2*cells.size();
+		std::vector<uint8_t> m(K);
+		for (size_t kind = 0; kind < K; kind++) {
+			t_signature sig = cells.signatures[kind/2];
+			bool target = kind % 2;
+			switch (s.node->op) {
+				case CMOp::Feature:
+					m[kind] = (sig >> s.node->value) & 1;
+					break;
+				case CMOp::Target: 		m[kind] = target; break;
+				case CMOp::Distractor: 	m[kind] = !target; break;
+				case CMOp::Universe: 	m[kind] = true; break;
+				case CMOp::Union:
+					m[kind] = members[s.kids[0]][kind] || members[s.kids[1]][kind];
+					break;
+				case CMOp::Intersection:
+					m[kind] = members[s.kids[0]][kind] && members[s.kids[1]][kind];
+					break;
+				case CMOp::Setminus:
+					m[kind] = members[s.kids[0]][kind] && !members[s.kids[1]][kind];
+					break;
+				default:
+					throw std::runtime_error(
+						"Cannot evaluate as a set: " + cmopToString(s.node->op));
+			}
+		}
+		return m;
+	}
+
+public:
+
+	CountMeaning(const CNode& meaning, const CellPartition& cells) :
+		FlatMeaning(meaning), cells(cells) {
+
+		std::vector<std::vector<uint8_t>> members(slots.size());
+		cardKinds.resize(slots.size());
+		for (size_t i = 0; i < slots.size(); i++) {
+			if (slots[i].type == CMType::Set) {
+				members[i] = kinds(slots[i], members);
+			} else if (slots[i].node->op == CMOp::Card) {
+				const auto& set = members[slots[i].kids[0]];
+				for (size_t kind = 0; kind < set.size(); kind++) {
+					if (set[kind]) cardKinds[i].push_back(kind);
+				}
+			}
+		}
+	}
+
+	// Truth value when cell c has counts[c] targets
+	std::optional<bool> value(const std::vector<size_t>& counts) {
+		for (size_t i = 0; i < slots.size(); i++) {
+			if (slots[i].node->op != CMOp::Card) continue;
+			long n = 0;
+			for (size_t kind : cardKinds[i]) {
+				size_t c = kind/2;
+				n += kind % 2 ? counts[c] : cells.entities[c].size() - counts[c];
+			}
+			ints[i] = n;
+		}
+		evaluateScalars();
+		return FlatMeaning::value();
+	}
+};
+
+// Closure meaning evaluated on one representative variation
+// for each configuration of counts: the first counts[c]
+// entities of cell c are the targets.
+// Only exact for closures that are permutation invariant.
+// The partition must use the full signatures, since a
+// closure may look at any feature.
+class CountContext {
+private:
+
+	const t_t_M& meaning;
+	const ObservedContext& oc;
+	const CellPartition& cells;
+
+public:
+
+	CountContext(
+			const t_t_M& meaning,
+			const ObservedContext& oc,
+			const CellPartition& cells
+		) : meaning(meaning), oc(oc), cells(cells) {}
+
+	std::optional<bool> value(const std::vector<size_t>& counts) const {
+		t_context context;
+		for (size_t c = 0; c < cells.size(); c++) {
+			const auto& entities = cells.entities[c];
+			for (size_t i = 0; i < entities.size(); i++) {
+				context.insert(std::make_tuple(
+					oc.ints[entities[i]],
+					i < counts[c]
+				));
+			}
+		}
+		try {
+			return meaning(context);
+		} catch (PresuppositionFailure& e) {
+			return std::nullopt;
+		}
+	}
+};
+
+// Pascal's triangle up to n, in doubles so that
+// the number of variations of large contexts does not overflow
+std::vector<std::vector<double>> binomials(size_t n) {
+	std::vector<std::vector<double>> b(n+1);
+	for (size_t i = 0; i <= n; i++) {
+		b[i].assign(i+1, 1.0);
+		for (size_t k = 1; k < i; k++) {
+			b[i][k] = b[i-1][k-1] + b[i-1][k];
+		}
+	}
+	return b;
+}
+
+// Visits every configuration of target counts per cell
+// with a count evaluator (CountMeaning or CountContext).
+// The result is the same as visiting every variation.
+template <typename Evaluator>
+ListenerPosterior countingListener(
+		const ObservedContext& oc,
+		const CellPartition& cells,
+		Evaluator& evaluator
+	) {
+
+	const size_t C = cells.size();
+	size_t largest = 0;
+	for (auto& e : cells.entities) largest = std::max(largest, e.size());
+	const auto binom = binomials(largest);
+
+	ListenerPosterior post;
+
+	// The observed variation
+	std::vector<size_t> counts(C, 0);
+	for (size_t j = 0; j < oc.size(); j++) {
+		counts[cells.cellOf[j]] += oc.targets[j];
+	}
+	std::optional<bool> observed = evaluator.value(counts);
+	post.observedTrue = observed.has_value() && *observed;
+
+	// Number of true variations, in total and weighted
+	// by the number of targets in each cell
+	double nTrue = 0;
+	std::vector<double> cellTargets(C, 0);
+	std::fill(counts.begin(), counts.end(), 0);
+	while (true) {
+		std::optional<bool> v = evaluator.value(counts);
+		if (v.has_value() && *v) {
+			double weight = 1;
+			for (size_t c = 0; c < C; c++) {
+				weight *= binom[cells.entities[c].size()][counts[c]];
+			}
+			nTrue += weight;
+			for (size_t c = 0; c < C; c++) {
+				cellTargets[c] += weight * counts[c];
+			}
+		}
+		// next configuration, odometer-style
+		size_t c = 0;
+		while (c < C && counts[c] == cells.entities[c].size()) {
+			counts[c] = 0;
+			c++;
+		}
+		if (c == C) break;
+		counts[c]++;
+	}
+
+	post.nTrue = nTrue;
+	post.nVariations = std::ldexp(1.0, oc.size());
+	post.marginals.assign(oc.size(), 0);
+	for (size_t j = 0; j < oc.size(); j++) {
+		size_t c = cells.cellOf[j];
+		// entities in a cell are exchangeable
+		post.marginals[j] =
+			cellTargets[c] / cells.entities[c].size() / nTrue;
+	}
+	return post;
+}
@@ -0,0 +1,183 @@
+# pragma once
+
+// Runtime selection of the instruction set used by the kernels.
+// kernelsImpl.h is compiled once for the generic x86-64 baseline
+// and once each for AVX2 and AVX-512, in the same binary.
+// The best variant the CPU supports is selected at startup,
+// so a single (static) binary runs at full speed on every node.
+// The --isa option forces a variant, e.g. for benchmarking.
+
+namespace kernels_generic {
+#include "kernelsImpl.h"
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define MULTIVERSION_KERNELS
+
+#if defined(__clang__)
+#pragma clang attribute push \
+	(__attribute__((target("avx2,fma,bmi2,popcnt"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx2,fma,bmi2,popcnt")
+#endif
+namespace kernels_avx2 {
+#include "kernelsImpl.h"
+}
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+
+#if defined(__clang__)
+#pragma clang attribute push \
+	(__attribute__((target("avx512f,avx512bw,avx512vl,avx2,fma,bmi2,popcnt"))), \
+	 apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw,avx512vl,avx2,fma,bmi2,popcnt")
+#endif
+namespace kernels_avx512 {
+#include "kernelsImpl.h"
+}
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+
+#endif
+
+enum class KernelISA { Generic, AVX2, AVX512 };
+
+struct KernelTable {
+	KernelISA isa;
+	std::string name;
+	void (*scoreSpeakerListener)(ScoreBatch&, double);
+	double (*targetLogLikelihood)(const double*, const uint8_t*, size_t);
+	void (*evaluateLanes)(
+		const CNode&, const ObservedContext&, size_t, ListenerPosterior&);
+};
+
+KernelTable kernelTable(KernelISA isa) {
+	switch (isa) {
+#ifdef MULTIVERSION_KERNELS
+		case KernelISA::AVX512:
+			return {
+				isa, "avx512",
+				kernels_avx512::scoreSpeakerListener,
+				kernels_avx512::targetLogLikelihood,
+				kernels_avx512::evaluateLanes
+			};
+		case KernelISA::AVX2:
+			return {
+				isa, "avx2",
+				kernels_avx2::scoreSpeakerListener,
+				kernels_avx2::targetLogLikelihood,
+				kernels_avx2::evaluateLanes
+			};
+#endif
+		default:
+			return {
+				KernelISA::Generic, "generic",
+				kernels_generic::scoreSpeakerListener,
+				kernels_generic::targetLogLikelihood,
+				kernels_generic::evaluateLanes
+			};
+	}
+}
+
+bool isaSupported(KernelISA isa) {
+#ifdef MULTIVERSION_KERNELS
+	__builtin_cpu_init();
+	bool avx2 =
+		__builtin_cpu_supports("avx2") &&
+		__builtin_cpu_supports("fma") &&
+		__builtin_cpu_supports("bmi2") &&
+		__builtin_cpu_supports("popcnt");
+	switch (isa) {
+		case KernelISA::AVX512:
+			return avx2 &&
+				__builtin_cpu_supports("avx512f") &&
+				__builtin_cpu_supports("avx512bw") &&
+				__builtin_cpu_supports("avx512vl");
+		case KernelISA::AVX2:
+			return avx2;
+		default:
+			return true;
+	}
+#else
+	return isa == KernelISA::Generic;
+#endif
+}
+
+KernelISA bestISA() {
+	for (KernelISA isa : {KernelISA::AVX512, KernelISA::AVX2}) {
+		if (isaSupported(isa)) return isa;
+	}
+	return KernelISA::Generic;
+}
+
+// The kernels in use. Only change it at startup,
+// before any thread calls the kernels.
+KernelTable activeKernels = kernelTable(bestISA());
+
+// Selects the kernels by name ("auto", "generic", "avx2", "avx512").
+// Variants the CPU does not support are refused.
+void setKernelISA(const std::string& name) {
+	static const std::map<std::string, KernelISA> names = {
+		{"generic", KernelISA::Generic},
+		{"avx2", KernelISA::AVX2},
+		{"avx512", KernelISA::AVX512}
+	};
+	if (name == "auto") {
+		activeKernels = kernelTable(bestISA());
+		return;
+	}
+	auto it = names.find(name);
+	if (it == names.end()) {
+		throw std::runtime_error("Unknown instruction set: " + name);
+	}
+	if (!isaSupported(it->second)) {
+		std::cerr
+			<< "WARNING: CPU does not support " << name
+			<< ", using " << kernelTable(bestISA()).name
+			<< std::endl;
+		activeKernels = kernelTable(bestISA());
+		return;
+	}
+	activeKernels = kernelTable(it->second);
+}
+
+///// Entry points used by the rest of the model
+
+void scoreSpeakerListener(ScoreBatch& batch, double alpha) {
+	activeKernels.scoreSpeakerListener(batch, alpha);
+}
+
+double targetLogLikelihood(
+		const double* probs,
+		const uint8_t* targets,
+		size_t n
+	) {
+	return activeKernels.targetLogLikelihood(probs, targets, n);
+}
+
+// Evaluates a compiled sentence meaning in all the
+// target variations of the observed context at once.
+// Returns nullopt if the context or the ints in the meaning
+// are too large for lanes.
+std::optional<ListenerPosterior> evaluateLanes(
+		const t_cnode& meaning,
+		const ObservedContext& oc
+	) {
+
+	const size_t width = laneIntWidth(*meaning, oc.size());
+	if (oc.size() > maxLaneContextSize || width > maxLaneIntWidth) {
+		return std::nullopt;
+	}
+	ListenerPosterior post;
+	activeKernels.evaluateLanes(*meaning, oc, width, post);
+	return post;
+}
@@ -0,0 +1,398 @@
+# pragma once
+
+// Exhaustive enumeration of the QuantsHypothesis programs,
+// as an alternative to sampling them (see runTradeoffEnumeration).
+// Every program up to a size or down to a prior is listed,
+// but most of them mean the same thing: e.g. ( union %s.L %s.L )
+// and %s.L, or two quantifiers that only differ in a branch that
+// is never reached. So programs are grouped by what they do,
+// and only the simplest one of each group (the highest prior)
+// is evaluated, since the others have the same communicative
+// accuracy on the same contexts and a lower prior.
+//
+// What a program does is read off its compiled meaning.
+// Quantifiers and composition rules only look at their
+// arguments L and R through cardinalities of sets built from
+// L, R and the context, i.e. through the sizes of the four
+// regions of the Venn diagram of L and R in the context.
+// So a quantifier is known by its count table: its truth for every
+// way of splitting the cSize entities of a context into the regions.
+// A DP [Q IV] means the composition rule applied to Q, which
+// is known by its count table too, and the agent sees nothing
+// else of the hypothesis. So the fingerprint of a hypothesis
+// is the count tables of the rule applied to each of Q1, Q2, Q3.
+// Programs that do not compile keep a fingerprint of their own.
+//
+// The four parts of a program (the rule and the three quantifiers)
+// are enumerated and grouped separately first, since swapping
+// a part for the simplest one that does the same does not change
+// the fingerprint and does not lower the prior.
+
+// A program of the grammar, as serialized by Fleet
+struct EnumeratedTree {
+	std::string serialized;
+	// minus the log prior
+	double cost;
+	size_t nodes;
+};
+
+// Lists the programs of a Fleet grammar by nonterminal,
+// with at most maxNodes nodes and at most maxCost cost
+// (0 and infinity are no bound), cheapest first.
+template <typename Grammar>
+class TreeEnumerator {
+private:
+
+	const Grammar& grammar;
+	size_t maxNodes;
+	double maxCost;
+	// cheapest and smallest program of each nonterminal
+	// (infinity and SIZE_MAX if it has none)
+	std::vector<double> minCost;
+	std::vector<size_t> minNodes;
+	// programs of a nonterminal and node budget,
+	// with the cost budget they were listed for
+	std::map<
+		std::pair<nonterminal_t, size_t>,
+		std::pair<double, std::vector<EnumeratedTree>>
+	> memo;
+
+	static constexpr double eps = 1e-9;
+
+	bool bounded() const { return maxNodes > 0; }
+
+	bool reachable(const Rule& r) const {
+		for (size_t i = 0; i < r.N; i++) {
+			if (minCost[r.type(i)] == infinity) return false;
+		}
+		return true;
+	}
+
+	std::vector<EnumeratedTree> expand(nonterminal_t nt, size_t nodes, double cost) {
+		std::vector<EnumeratedTree> out;
+		for (auto& r : grammar.rules[nt]) {
+			if (!reachable(r)) continue;
+			std::vector<EnumeratedTree> partial{
+				{std::to_string(nt) + ":" + r.format, ruleCost(nt, r), 1}
+			};
+			// children in order, leaving room for the ones after
+			for (size_t i = 0; i < r.N; i++) {
+				double restCost = 0;
+				size_t restNodes = 0;
+				for (size_t j = i+1; j < r.N; j++) {
+					restCost += minCost[r.type(j)];
+					restNodes += minNodes[r.type(j)];
+				}
+				std::vector<EnumeratedTree> next;
+				for (auto& p : partial) {
+					if (bounded() && p.nodes + restNodes >= nodes) continue;
+					size_t kidNodes = bounded() ? nodes - p.nodes - restNodes : nodes;
+					for (auto& k : trees(r.type(i), kidNodes, cost - p.cost - restCost)) {
+						next.push_back({
+							p.serialized + ";" + k.serialized,
+							p.cost + k.cost,
+							p.nodes + k.nodes
+						});
+					}
+				}
+				partial = std::move(next);
+			}
+			for (auto& p : partial) {
+				if (p.cost <= cost + eps) out.push_back(std::move(p));
+			}
+		}
+		std::sort(out.begin(), out.end(), [](auto& a, auto& b) {
+			if (a.cost != b.cost) return a.cost < b.cost;
+			return a.serialized < b.serialized;
+		});
+		return out;
+	}
+
+public:
+
+	TreeEnumerator(const Grammar& grammar, size_t maxNodes, double maxCost) :
+		grammar(grammar), maxNodes(maxNodes), maxCost(maxCost),
+		minCost(Grammar::N_NTs, infinity), minNodes(Grammar::N_NTs, SIZE_MAX) {
+		if (maxNodes == 0 && maxCost == infinity) {
+			throw std::runtime_error("Enumeration needs a maximum size or a minimum prior");
+		}
+		// until nothing gets cheaper or smaller
+		bool changed = true;
+		while (changed) {
+			changed = false;
+			for (nonterminal_t nt = 0; nt < Grammar::N_NTs; nt++) {
+				for (auto& r : grammar.rules[nt]) {
+					if (!reachable(r)) continue;
+					double c = ruleCost(nt, r);
+					size_t n = 1;
+					for (size_t i = 0; i < r.N; i++) {
+						c += minCost[r.type(i)];
+						n += minNodes[r.type(i)];
+					}
+					if (c < minCost[nt] - eps) { minCost[nt] = c; changed = true; }
+					if (n < minNodes[nt]) { minNodes[nt] = n; changed = true; }
+				}
+			}
+		}
+	}
+
+	double cheapest(nonterminal_t nt) const { return minCost[nt]; }
+
+	// Minus the log probability of expanding nt with r
+	double ruleCost(nonterminal_t nt, const Rule& r) const {
+		double z = 0;
+		for (auto& s : grammar.rules[nt]) z += s.p;
+		return std::log(z) - std::log(r.p);
+	}
+
+	// The programs of nt with at most nodes nodes
+	// (ignored without a size bound) and at most cost cost
+	std::vector<EnumeratedTree> trees(nonterminal_t nt, size_t nodes, double cost) {
+		cost = std::min(cost, maxCost);
+		if (!bounded()) nodes = SIZE_MAX;
+		if (cost < minCost[nt] - eps || nodes < minNodes[nt]) return {};
+		auto key = std::make_pair(nt, nodes);
+		auto it = memo.find(key);
+		if (it == memo.end() || it->second.first < cost) {
+			auto listed = expand(nt, nodes, cost);
+			memo[key] = {cost, std::move(listed)};
+			it = memo.find(key);
+		}
+		std::vector<EnumeratedTree> out;
+		for (auto& t : it->second.second) {
+			if (t.cost > cost + eps) break;
+			out.push_back(t);
+		}
+		return out;
+	}
+};
+
+///// Count tables
+
+// Sets are unions of the regions of the Venn diagram of L and R
+// in the context: bit 0 is L and R, bit 1 is L only, bit 2 is
+// R only and bit 3 is neither. counts are the sizes of the regions
+uint8_t regionSet(const CNode& n) {
+	switch (n.op) {
+		case CMOp::ArgL: 			return 0b0011;
+		case CMOp::ArgR: 			return 0b0101;
+		case CMOp::Universe: 		return 0b1111;
+		case CMOp::Union: 			return regionSet(*n.kids[0]) | regionSet(*n.kids[1]);
+		case CMOp::Intersection: 	return regionSet(*n.kids[0]) & regionSet(*n.kids[1]);
+		case CMOp::Setminus: 		return regionSet(*n.kids[0]) & ~regionSet(*n.kids[1]);
+		default:
+			throw std::runtime_error("No count table for " + cmopToString(n.op));
+	}
+}
+
+int regionInt(const CNode& n, const std::array<int, 4>& counts) {
+	switch (n.op) {
+		case CMOp::Const: 	return n.value;
+		case CMOp::Card: {
+			uint8_t s = regionSet(*n.kids[0]);
+			int c = 0;
+			for (size_t k = 0; k < 4; k++) if ((s >> k) & 1) c += counts[k];
+			return c;
+		}
+		case CMOp::Plus: 	return regionInt(*n.kids[0], counts) + regionInt(*n.kids[1], counts);
+		case CMOp::Minus: 	return regionInt(*n.kids[0], counts) - regionInt(*n.kids[1], counts);
+		default:
+			throw std::runtime_error("No count table for " + cmopToString(n.op));
+	}
+}
+
+bool regionBool(const CNode& n, const std::array<int, 4>& counts) {
+	switch (n.op) {
+		case CMOp::BoolConst: 	return n.value;
+		case CMOp::IntEq: 		return regionInt(*n.kids[0], counts) == regionInt(*n.kids[1], counts);
+		case CMOp::IntGt: 		return regionInt(*n.kids[0], counts) > regionInt(*n.kids[1], counts);
+		case CMOp::Not: 		return !regionBool(*n.kids[0], counts);
+		case CMOp::And: 		return regionBool(*n.kids[0], counts) && regionBool(*n.kids[1], counts);
+		case CMOp::Or: 			return regionBool(*n.kids[0], counts) || regionBool(*n.kids[1], counts);
+		// e.g. presuppositions, which the grammar cannot build
+		default:
+			throw std::runtime_error("No count table for " + cmopToString(n.op));
+	}
+}
+
+// The truth of a meaning of L and R for every split of
+// the cSize entities of a context into the four regions,
+// or nothing if it is not a function of the counts
+std::optional<std::string> countTable(const t_cnode& n, size_t cSize) {
+	if (!n) return std::nullopt;
+	int N = cSize;
+	std::string table;
+	try {
+		for (int a = 0; a <= N; a++) {
+			for (int b = 0; a + b <= N; b++) {
+				for (int c = 0; a + b + c <= N; c++) {
+					table += regionBool(*n, {a, b, c, N - a - b - c}) ? '1' : '0';
+				}
+			}
+		}
+	} catch (std::runtime_error& e) {
+		return std::nullopt;
+	}
+	return table;
+}
+
+// The compiled meaning of a part of a program
+t_cnode compileTree(const EnumeratedTree& t) {
+	try {
+		return Quants_DSL::compileProgram(parseSerializedProgram(t.serialized));
+	} catch (std::exception& e) {
+		return nullptr;
+	}
+}
+
+// Serialized QuantsHypothesis programs with pairwise different
+// fingerprints, the simplest of each, from the highest prior.
+// maxNodes bounds each of the four parts, minPrior the whole
+// program (0 and -infinity are no bound).
+template <typename Grammar>
+std::vector<std::string> enumerateDistinctPrograms(
+		const Grammar& grammar,
+		nonterminal_t root,
+		size_t cSize,
+		size_t maxNodes,
+		double minPrior
+	) {
+
+	double maxCost = minPrior == 0 ? infinity : -minPrior;
+	TreeEnumerator<Grammar> enumerator(grammar, maxNodes, maxCost);
+	if (grammar.rules[root].size() != 1 || grammar.rules[root][0].N != 4) {
+		throw std::runtime_error("Enumeration expects a rule and three quantifiers");
+	}
+	const Rule& top = grammar.rules[root][0];
+	std::string head = std::to_string(root) + ":" + top.format;
+	double rootCost = enumerator.ruleCost(root, top);
+	nonterminal_t ruleNt = top.type(0);
+	nonterminal_t quantNt = top.type(1);
+	double ruleMin = enumerator.cheapest(ruleNt);
+	double quantMin = enumerator.cheapest(quantNt);
+
+	auto rules = enumerator.trees(ruleNt, maxNodes, maxCost - rootCost - 3*quantMin);
+	auto quants = enumerator.trees(quantNt, maxNodes, maxCost - rootCost - ruleMin - 2*quantMin);
+
+	// Quantifiers by count table. They are cheapest first,
+	// so the first of each table is the simplest
+	std::vector<std::optional<std::string>> quantTables(quants.size());
+	std::vector<t_cnode> quantNodes(quants.size());
+	taskPool.parallelFor(quants.size(), [&](size_t i) {
+		quantNodes[i] = compileTree(quants[i]);
+		quantTables[i] = countTable(quantNodes[i], cSize);
+	});
+	std::vector<size_t> quantClasses;
+	std::set<std::string> seen;
+	for (size_t i = 0; i < quants.size(); i++) {
+		if (!quantTables[i] || seen.insert(*quantTables[i]).second) {
+			quantClasses.push_back(i);
+		}
+	}
+
+	// The count table of each rule applied to each quantifier,
+	// as ids shared by all rules
+	std::unordered_map<std::string, uint32_t> tableIds;
+	std::shared_mutex tableMutex;
+	std::atomic<uint32_t> nIds{0};
+	auto tableId = [&](const std::optional<std::string>& table) -> uint32_t {
+		// no table: a fingerprint of its own
+		if (!table) return nIds++;
+		{
+			std::shared_lock lock(tableMutex);
+			auto it = tableIds.find(*table);
+			if (it != tableIds.end()) return it->second;
+		}
+		std::unique_lock lock(tableMutex);
+		auto [it, added] = tableIds.emplace(*table, 0);
+		if (added) it->second = nIds++;
+		return it->second;
+	};
+	std::vector<std::vector<uint32_t>> composed(rules.size());
+	taskPool.parallelFor(rules.size(), [&](size_t i) {
+		t_cnode rule = compileTree(rules[i]);
+		for (size_t q : quantClasses) {
+			std::optional<std::string> table;
+			if (rule && quantNodes[q]) {
+				try {
+					table = countTable(
+						substitute(rule, cnode(CMOp::ArgL), cnode(CMOp::ArgR), quantNodes[q]),
+						cSize);
+				} catch (std::runtime_error& e) {}
+			}
+			composed[i].push_back(tableId(table));
+		}
+	});
+	// Rules by what they do to every quantifier
+	std::vector<size_t> ruleClasses;
+	std::set<std::vector<uint32_t>> seenRules;
+	for (size_t i = 0; i < rules.size(); i++) {
+		if (seenRules.insert(composed[i]).second) ruleClasses.push_back(i);
+	}
+	if (nIds >= (1 << 21)) {
+		throw std::runtime_error("Too many composed meanings to enumerate");
+	}
+
+	// Hypotheses by the three composed tables, the simplest of each
+	struct Best {
+		double cost;
+		size_t rule;
+		std::array<size_t, 3> quants;
+	};
+	std::unordered_map<uint64_t, Best> best;
+	auto program = [&](const Best& b) {
+		return head + ";" + rules[b.rule].serialized
+			+ ";" + quants[b.quants[0]].serialized
+			+ ";" + quants[b.quants[1]].serialized
+			+ ";" + quants[b.quants[2]].serialized;
+	};
+	for (size_t r : ruleClasses) {
+		// the simplest quantifier giving each composed table
+		std::vector<std::pair<uint32_t, size_t>> options;
+		std::set<uint32_t> ids;
+		for (size_t k = 0; k < quantClasses.size(); k++) {
+			if (ids.insert(composed[r][k]).second) {
+				options.emplace_back(composed[r][k], quantClasses[k]);
+			}
+		}
+		double base = rootCost + rules[r].cost;
+		for (auto& [a1, q1] : options) {
+			double c1 = base + quants[q1].cost;
+			if (c1 + 2*quantMin > maxCost + 1e-9) break;
+			for (auto& [a2, q2] : options) {
+				double c2 = c1 + quants[q2].cost;
+				if (c2 + quantMin > maxCost + 1e-9) break;
+				for (auto& [a3, q3] : options) {
+					double c3 = c2 + quants[q3].cost;
+					if (c3 > maxCost + 1e-9) break;
+					uint64_t key = (uint64_t(a1) << 42) | (uint64_t(a2) << 21) | a3;
+					Best b{c3, r, {q1, q2, q3}};
+					auto it = best.find(key);
+					if (it == best.end()) {
+						best.emplace(key, b);
+					} else if (c3 < it->second.cost ||
+							(c3 == it->second.cost && program(b) < program(it->second))) {
+						it->second = b;
+					}
+				}
+			}
+		}
+	}
+
+	std::vector<Best> distinct;
+	for (auto& [key, b] : best) distinct.push_back(b);
+	std::sort(distinct.begin(), distinct.end(), [&](auto& a, auto& b) {
+		if (a.cost != b.cost) return a.cost < b.cost;
+		return program(a) < program(b);
+	});
+	std::vector<std::string> programs;
+	for (auto& b : distinct) programs.push_back(program(b));
+
+	std::cout
+		<< "Enumeration: "
+		<< rules.size() << " composition rules (" << ruleClasses.size() << " distinct), "
+		<< quants.size() << " quantifiers (" << quantClasses.size() << " distinct), "
+		<< programs.size() << " distinct hypotheses"
+		<< std::endl;
+	return programs;
+}
@@ -0,0 +1,275 @@
+# pragma once
+
+// Incremental evaluation of a meaning over the target variations
+// of an observed context, for meanings that cannot be evaluated
+// with lanes (closures, or compiled meanings whose context or ints
+// are too large for lanes).
+// The variations are visited in Gray-code order, so consecutive
+// variations differ in the target bit of a single entity,
+// and the evaluator only updates what that entity changes.
+
+// Enumerating more variations than this is hopeless anyway
+const size_t maxGrayCodeContextSize = 40;
+
+// A compiled meaning flattened into slots, one per node,
+// in post-order (kids before their parents).
+// Subclasses keep the sets and the cardinalities up to date,
+// and the rest of the meaning is recomputed from them.
+class FlatMeaning {
+protected:
+
+	struct Slot {
+		const CNode* node;
+		CMType type;
+		std::vector<size_t> kids;
+	};
+	std::vector<Slot> slots;
+
+	// Int slots: current value
+	std::vector<long> ints;
+	// Bool slots: current value and whether it is defined
+	std::vector<uint8_t> bools;
+	std::vector<uint8_t> defined;
+
+	size_t flatten(const CNode& n) {
+		Slot slot{&n, cnodeType(n)};
+		for (auto& k : n.kids) {
+			slot.kids.push_back(flatten(*k));
+		}
+		slots.push_back(slot);
+		return slots.size() - 1;
+	}
+
+	FlatMeaning(const CNode& meaning) {
+		flatten(meaning);
+		ints.assign(slots.size(), 0);
+		bools.assign(slots.size(), 0);
+		defined.assign(slots.size(), 1);
+	}
+
+	// Recomputes the ints (apart from the cardinalities,
+	// which are kept up to date by the subclass) and the bools
+	void evaluateScalars() {
+		for (size_t i = 0; i < slots.size(); i++) {
+			const Slot& s = slots[i];
+			const auto& k = s.kids;
+			switch (s.node->op) {
+				case CMOp::Const: ints[i] = s.node->value; break;
+				case CMOp::Plus:  ints[i] = ints[k[0]] + ints[k[1]]; break;
+				case CMOp::Minus: ints[i] = ints[k[0]] - ints[k[1]]; break;
+				case CMOp::BoolConst:
+					bools[i] = s.node->value;
+					defined[i] = true;
+					break;
+				case CMOp::IntEq:
+					bools[i] = ints[k[0]] == ints[k[1]];
+					defined[i] = true;
+					break;
+				case CMOp::IntGt:
+					bools[i] = ints[k[0]] > ints[k[1]];
+					defined[i] = true;
+					break;
+				case CMOp::Not:
+					bools[i] = !bools[k[0]];
+					defined[i] = defined[k[0]];
+					break;
+				case CMOp::And:
+				case CMOp::Or:
+					bools[i] = s.node->op == CMOp::And ?
+						bools[k[0]] && bools[k[1]] :
+						bools[k[0]] || bools[k[1]];
+					defined[i] = defined[k[0]] && defined[k[1]];
+					break;
+				case CMOp::IfElse:
+					bools[i] = bools[k[0]] ? bools[k[1]] : bools[k[2]];
+					defined[i] = defined[k[0]] && defined[k[1]] && defined[k[2]];
+					break;
+				case CMOp::Presup:
+					bools[i] = bools[k[1]];
+					defined[i] =
+						bools[k[0]] && defined[k[0]] && defined[k[1]];
+					break;
+				default:
+					break;
+			}
+		}
+	}
+
+public:
+
+	// nullopt if the meaning has a presupposition failure
+	std::optional<bool> value() const {
+		if (!defined.back()) return std::nullopt;
+		return bools.back();
+	}
+};
+
+// Compiled meaning with the cardinalities kept up to date
+// as single target bits flip. A flip costs O(size of the meaning),
+// independently of the size of the context.
+class IncrementalMeaning : public FlatMeaning {
+private:
+
+	const ObservedContext& oc;
+	// Current target bit of each entity
+	std::vector<uint8_t> targets;
+	// Set slots: membership of each entity, and membership
+	// of the last flipped entity before the flip
+	std::vector<std::vector<uint8_t>> members;
+	std::vector<uint8_t> previous;
+
+	bool member(const Slot& s, size_t j) const {
+		switch (s.node->op) {
+			case CMOp::Feature:
+				return (oc.signatures[j] >> s.node->value) & 1;
+			case CMOp::Target: 		return targets[j];
+			case CMOp::Distractor: 	return !targets[j];
+			case CMOp::Universe: 	return true;
+			case CMOp::Union:
+				return members[s.kids[0]][j] || members[s.kids[1]][j];
+			case CMOp::Intersection:
+				return members[s.kids[0]][j] && members[s.kids[1]][j];
+			case CMOp::Setminus:
+				return members[s.kids[0]][j] && !members[s.kids[1]][j];
+			default:
+				throw std::runtime_error(
+					"Cannot evaluate as a set: " + cmopToString(s.node->op));
+		}
+	}
+
+public:
+
+	// Starts from the variation where every entity is a distractor
+	IncrementalMeaning(const CNode& meaning, const ObservedContext& oc) :
+		FlatMeaning(meaning), oc(oc), targets(oc.size(), 0) {
+
+		const size_t N = oc.size();
+		members.resize(slots.size());
+		previous.assign(slots.size(), 0);
+
+		for (size_t i = 0; i < slots.size(); i++) {
+			if (slots[i].type == CMType::Set) {
+				members[i].resize(N);
+				for (size_t j = 0; j < N; j++) {
+					members[i][j] = member(slots[i], j);
+				}
+			} else if (slots[i].node->op == CMOp::Card) {
+				const auto& set = members[slots[i].kids[0]];
+				ints[i] = std::count(set.begin(), set.end(), 1);
+			}
+		}
+		evaluateScalars();
+	}
+
+	void flip(size_t j, bool target) {
+		targets[j] = target;
+		for (size_t i = 0; i < slots.size(); i++) {
+			const Slot& s = slots[i];
+			if (s.type == CMType::Set) {
+				previous[i] = members[i][j];
+				members[i][j] = member(s, j);
+			} else if (s.node->op == CMOp::Card) {
+				// kids come before their parents, so the
+				// membership of the kid is already updated
+				size_t k = s.kids[0];
+				ints[i] += (long)members[k][j] - (long)previous[k];
+			}
+		}
+		evaluateScalars();
+	}
+};
+
+// Closure meaning evaluated on a context that is updated
+// in place, instead of building every variation from scratch
+class IncrementalContext {
+private:
+
+	const t_t_M& meaning;
+	const ObservedContext& oc;
+	t_context context;
+
+public:
+
+	// Starts from the variation where every entity is a distractor
+	IncrementalContext(const t_t_M& meaning, const ObservedContext& oc) :
+		meaning(meaning), oc(oc) {
+		for (int i : oc.ints) {
+			context.insert(std::make_tuple(i, false));
+		}
+	}
+
+	void flip(size_t j, bool target) {
+		context.erase(std::make_tuple(oc.ints[j], !target));
+		context.insert(std::make_tuple(oc.ints[j], target));
+	}
+
+	// nullopt if the meaning has a presupposition failure
+	std::optional<bool> value() const {
+		try {
+			return meaning(context);
+		} catch (PresuppositionFailure& e) {
+			return std::nullopt;
+		}
+	}
+};
+
+// Visits every target variation of the observed context
+// in Gray-code order with an incremental evaluator
+// (IncrementalMeaning or IncrementalContext).
+// The marginals are accumulated lazily: each entity remembers
+// how many true variations had been seen when it became a target,
+// so each step is O(1) on top of the evaluator.
+template <typename Evaluator>
+ListenerPosterior grayCodeListener(
+		const ObservedContext& oc,
+		Evaluator& evaluator
+	) {
+
+	const size_t N = oc.size();
+	if (N > maxGrayCodeContextSize) {
+		throw std::runtime_error(
+			"Too many variations to enumerate for context size "
+			+ std::to_string(N)
+		);
+	}
+
+	// true variations so far
+	uint64_t nTrue = 0;
+	// nTrue when each entity last became a target
+	std::vector<uint64_t> since(N, 0);
+	// true variations where each entity was a target
+	std::vector<uint64_t> counts(N, 0);
+
+	ListenerPosterior post;
+	uint64_t bits = 0;
+	const uint64_t total = uint64_t(1) << N;
+	for (uint64_t k = 0; k < total; k++) {
+		if (k > 0) {
+			// the bit that changes between Gray codes k-1 and k
+			size_t j = std::countr_zero(k);
+			bits ^= uint64_t(1) << j;
+			bool target = (bits >> j) & 1;
+			if (target) {
+				since[j] = nTrue;
+			} else {
+				counts[j] += nTrue - since[j];
+			}
+			evaluator.flip(j, target);
+		}
+		std::optional<bool> v = evaluator.value();
+		bool isTrue = v.has_value() && *v;
+		if (bits == oc.observedTargets) {
+			post.observedTrue = isTrue;
+		}
+		nTrue += isTrue;
+	}
+
+	post.nTrue = nTrue;
+	post.nVariations = std::ldexp(1.0, N);
+	post.marginals.assign(N, 0);
+	for (size_t j = 0; j < N; j++) {
+		if ((bits >> j) & 1) counts[j] += nTrue - since[j];
+		post.marginals[j] = (double)counts[j] / nTrue;
+	}
+	return post;
+}
@@ -0,0 +1,72 @@
+# pragma once
+
+// Batched numerical kernels for the speaker and the listener.
+// All the per-(context, sentence) quantities are stored
+// as flat row-major arrays, with one row per context
+// and one column per sentence. The inner loops then run over
+// contiguous memory with no branches, so the compiler
+// can auto-vectorize them.
+
+// A batch of contexts scored against the same sentence bank
+struct ScoreBatch {
+
+	size_t nContexts = 0;
+	size_t nSentences = 0;
+
+	///// Inputs
+
+	// 1 if sentence s is true in context b, 0 otherwise
+	std::vector<uint8_t> truth;
+	// -log P(s is true | ints of context b) for the literal listener.
+	// Only read where truth is 1.
+	std::vector<double> informativity;
+	// log of the number of target variations of each context
+	// (i.e., N*log(2) for a context of size N)
+	std::vector<double> logVariations;
+	// (scaled) complexity of each sentence
+	std::vector<double> complexity;
+
+	///// Outputs
+
+	// alpha*(info - complexity), in log space so that large
+	// alphas do not overflow. -inf for false sentences.
+	std::vector<double> utilities;
+	// Speaker probabilities, normalized within each context
+	std::vector<double> speakerProbs;
+	// Surprisal of the literal listener for the full
+	// target assignment of the context given the sentence,
+	// i.e. log(number of variations where s is true).
+	// +inf for false sentences.
+	std::vector<double> listenerSurprisals;
+
+	ScoreBatch() = default;
+
+	ScoreBatch(size_t nContexts, size_t nSentences) {
+		resize(nContexts, nSentences);
+	}
+
+	void resize(size_t nC, size_t nS) {
+		nContexts = nC;
+		nSentences = nS;
+		truth.assign(nC*nS, 0);
+		informativity.assign(nC*nS, 0.0);
+		logVariations.assign(nC, 0.0);
+		complexity.assign(nS, 0.0);
+		utilities.assign(nC*nS, 0.0);
+		speakerProbs.assign(nC*nS, 0.0);
+		listenerSurprisals.assign(nC*nS, 0.0);
+	}
+
+	size_t index(size_t b, size_t s) const {
+		return b*nSentences + s;
+	}
+
+	// Whether any sentence is true in context b
+	bool hasTrueSentence(size_t b) const {
+		const uint8_t* t = truth.data() + b*nSentences;
+		for (size_t s = 0; s < nSentences; s++) {
+			if (t[s]) return true;
+		}
+		return false;
+	}
+};
@@ -0,0 +1,432 @@
+// Kernels that are compiled once per instruction set.
+// NOTE: No pragma once! This file is included several times
+// by dispatch.h, each time inside a different namespace and
+// with different target options, so it must not include
+// anything and must only use what is declared before it.
+
+// Loops with a ?: on doubles are not vectorized: GCC turns it into
+// a branch, and does not execute arithmetic that could trap (set
+// a floating point exception) on the side the branch skips.
+// Selecting on the bits instead keeps everything unconditional
+[[gnu::always_inline]] inline double select(bool c, double a, double b) {
+	const uint64_t mask = -uint64_t(c);
+	return std::bit_cast<double>(
+		(std::bit_cast<uint64_t>(a) & mask) | (std::bit_cast<uint64_t>(b) & ~mask));
+}
+
+// exp and log written out in arithmetic, since loops that call
+// std::exp or std::log are not vectorized (they are calls to libm,
+// which may set errno). Both are within a few ulps of libm, for
+// any argument that comes up in the kernels: exp(-inf) is 0, and
+// log(0) is -inf. exp flushes results below exp(-708) to 0.
+[[gnu::always_inline]] inline double vectorExp(double x) {
+	const double inf = std::numeric_limits<double>::infinity();
+	// x = k*log(2) + r, with |r| <= log(2)/2.
+	// Adding 1.5*2^52 rounds x/log(2) to an integer k,
+	// which ends up in the low bits of t.
+	// Arguments out of range give garbage, replaced at the end
+	const double t = x * 1.4426950408889634 + 0x1.8p52;
+	const double k = t - 0x1.8p52;
+	const double r = (x - k * 6.93147180369123816490e-01)
+		- k * 1.90821492927058770002e-10;
+	// exp(r) by its Taylor series, to below an ulp
+	double p = 1.0 / 6227020800.0;
+	p = p * r + 1.0 / 479001600.0;
+	p = p * r + 1.0 / 39916800.0;
+	p = p * r + 1.0 / 3628800.0;
+	p = p * r + 1.0 / 362880.0;
+	p = p * r + 1.0 / 40320.0;
+	p = p * r + 1.0 / 5040.0;
+	p = p * r + 1.0 / 720.0;
+	p = p * r + 1.0 / 120.0;
+	p = p * r + 1.0 / 24.0;
+	p = p * r + 1.0 / 6.0;
+	p = p * r + 0.5;
+	p = p * r + 1.0;
+	p = p * r + 1.0;
+	// 2^k, from the exponent bits, as 2 * 2^(k-1)
+	// since 2^1024 itself is not a double
+	const uint64_t bits = (std::bit_cast<uint64_t>(t) << 52) + (uint64_t(1022) << 52);
+	const double y = (p + p) * std::bit_cast<double>(bits);
+	return select(x < -708.0, 0.0, select(x > 709.782712893384, inf, y));
+}
+
+[[gnu::always_inline]] inline double vectorLog(double x) {
+	const double inf = std::numeric_limits<double>::infinity();
+	// subnormals are scaled into the normal range first
+	const bool subnormal = x < 0x1p-1022;
+	const uint64_t bits = std::bit_cast<uint64_t>(x * select(subnormal, 0x1p54, 1.0));
+	// x = 2^e * m, with m in [sqrt(2)/2, sqrt(2))
+	double m = std::bit_cast<double>(
+		(bits & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL);
+	// the biased exponent, converted with the same trick as in exp
+	double e = std::bit_cast<double>((bits >> 52) | 0x4330000000000000ULL)
+		- 0x1p52 - select(subnormal, 1077.0, 1023.0);
+	const bool high = m > 1.4142135623730951;
+	m = m * select(high, 0.5, 1.0);
+	e = e + select(high, 1.0, 0.0);
+	// log(m) = 2 atanh(s), with s = (m-1)/(m+1) and |s| < 0.172
+	const double s = (m - 1.0) / (m + 1.0);
+	const double s2 = s * s;
+	double p = 1.0 / 23.0;
+	p = p * s2 + 1.0 / 21.0;
+	p = p * s2 + 1.0 / 19.0;
+	p = p * s2 + 1.0 / 17.0;
+	p = p * s2 + 1.0 / 15.0;
+	p = p * s2 + 1.0 / 13.0;
+	p = p * s2 + 1.0 / 11.0;
+	p = p * s2 + 1.0 / 9.0;
+	p = p * s2 + 1.0 / 7.0;
+	p = p * s2 + 1.0 / 5.0;
+	p = p * s2 + 1.0 / 3.0;
+	const double y = e * 6.93147180369123816490e-01
+		+ (2.0 * s + (2.0 * s * s2 * p + e * 1.90821492927058770002e-10));
+	const double nan = std::numeric_limits<double>::quiet_NaN();
+	return select(x == 0, -inf, select(x == inf, inf, select(x > 0, y, nan)));
+}
+
+// Reductions are split into this many partial sums
+// (or maxima), which are independent of each other, so that
+// they are vectorized without reordering the additions.
+// Their order is fixed, so it does not depend on the kernel
+const size_t nPartials = 8;
+
+// Computes utilities, speaker probabilities and listener
+// surprisals for every row of the batch.
+// Rows without any true sentence get all-zero probabilities.
+void scoreSpeakerListener(ScoreBatch& batch, double alpha) {
+
+	const double inf = std::numeric_limits<double>::infinity();
+	const size_t nS = batch.nSentences;
+	const double* complexity = batch.complexity.data();
+
+	for (size_t b = 0; b < batch.nContexts; b++) {
+
+		const uint8_t* truth = batch.truth.data() + b*nS;
+		const double*  info  = batch.informativity.data() + b*nS;
+		double* util  = batch.utilities.data() + b*nS;
+		double* probs = batch.speakerProbs.data() + b*nS;
+		double* surp  = batch.listenerSurprisals.data() + b*nS;
+		const double logVar = batch.logVariations[b];
+
+		// log-utilities and surprisals, in loops of
+		// their own so that they need few alias checks
+		for (size_t s = 0; s < nS; s++) {
+			util[s] = select(truth[s], alpha*(info[s] - complexity[s]), -inf);
+		}
+		for (size_t s = 0; s < nS; s++) {
+			surp[s] = select(truth[s], logVar - info[s], inf);
+		}
+
+		// and the row maximum
+		double partialMax[nPartials];
+		std::fill_n(partialMax, nPartials, -inf);
+		size_t s = 0;
+		for (; s + nPartials <= nS; s += nPartials) {
+			for (size_t k = 0; k < nPartials; k++) {
+				partialMax[k] = select(util[s+k] > partialMax[k], util[s+k], partialMax[k]);
+			}
+		}
+		double maxUtil = -inf;
+		for (; s < nS; s++) maxUtil = std::max(maxUtil, util[s]);
+		for (size_t k = 0; k < nPartials; k++) maxUtil = std::max(maxUtil, partialMax[k]);
+
+		if (maxUtil == -inf) {
+			std::fill(probs, probs + nS, 0.0);
+			continue;
+		}
+
+		// log-sum-exp normalization
+		for (size_t s = 0; s < nS; s++) {
+			probs[s] = vectorExp(util[s] - maxUtil);
+		}
+		double partialSum[nPartials] = {};
+		for (s = 0; s + nPartials <= nS; s += nPartials) {
+			for (size_t k = 0; k < nPartials; k++) partialSum[k] += probs[s+k];
+		}
+		double total = 0;
+		for (; s < nS; s++) total += probs[s];
+		for (size_t k = 0; k < nPartials; k++) total += partialSum[k];
+		const double norm = 1.0 / total;
+		for (size_t s = 0; s < nS; s++) {
+			probs[s] *= norm;
+		}
+	}
+}
+
+// Log-probability of the observed target bits
+// under the listener's marginals P(i is a target | utterance).
+// Each element contributes log(p) if it is a target
+// and log(1-p) if it is a distractor.
+double targetLogLikelihood(
+		const double* probs,
+		const uint8_t* targets,
+		size_t n
+	) {
+	// the logs of a block are computed first, in a loop
+	// of its own (the costly part, and the one that vectorizes),
+	// and then added to the partial sums
+	const size_t block = 64;
+	double logs[block];
+	double partialSum[nPartials] = {};
+	double total = 0;
+	for (size_t start = 0; start < n; start += block) {
+		const double*  p = probs + start;
+		const uint8_t* t = targets + start;
+		const size_t m = std::min(block, n - start);
+		for (size_t k = 0; k < m; k++) {
+			logs[k] = vectorLog(select(t[k], p[k], 1 - p[k]));
+		}
+		size_t k = 0;
+		for (; k + nPartials <= m; k += nPartials) {
+			for (size_t j = 0; j < nPartials; j++) partialSum[j] += logs[k+j];
+		}
+		for (; k < m; k++) total += logs[k];
+	}
+	for (size_t j = 0; j < nPartials; j++) total += partialSum[j];
+	return total;
+}
+
+class LaneEvaluator {
+private:
+
+	size_t N;
+	size_t nW;
+	size_t width;
+	const ObservedContext& oc;
+
+	using t_lanes = std::vector<uint64_t>;
+
+	struct LaneBool {
+		t_lanes value;
+		t_lanes defined;
+	};
+
+	///// Sets: N*nW words, entity-major
+
+	t_lanes evalSet(const CNode& n) const {
+		t_lanes out(N*nW);
+		switch (n.op) {
+			case CMOp::Feature:
+				for (size_t j = 0; j < N; j++) {
+					bool has = (oc.signatures[j] >> n.value) & 1;
+					std::fill_n(&out[j*nW], nW, has ? ~uint64_t(0) : 0);
+				}
+				break;
+			case CMOp::Target:
+			case CMOp::Distractor: {
+				uint64_t flip = n.op == CMOp::Distractor ? ~uint64_t(0) : 0;
+				for (size_t j = 0; j < N; j++) {
+					for (size_t w = 0; w < nW; w++) {
+						out[j*nW + w] = targetLanes(j, w) ^ flip;
+					}
+				}
+				break;
+			}
+			case CMOp::Universe:
+				std::fill(out.begin(), out.end(), ~uint64_t(0));
+				break;
+			case CMOp::Union:
+			case CMOp::Intersection:
+			case CMOp::Setminus: {
+				t_lanes a = evalSet(*n.kids[0]);
+				t_lanes b = evalSet(*n.kids[1]);
+				const size_t size = out.size();
+				if (n.op == CMOp::Union) {
+					for (size_t i = 0; i < size; i++) out[i] = a[i] | b[i];
+				} else if (n.op == CMOp::Intersection) {
+					for (size_t i = 0; i < size; i++) out[i] = a[i] & b[i];
+				} else {
+					for (size_t i = 0; i < size; i++) out[i] = a[i] & ~b[i];
+				}
+				break;
+			}
+			default:
+				throw std::runtime_error(
+					"Cannot evaluate as a set: " + cmopToString(n.op));
+		}
+		return out;
+	}
+
+	///// Ints: width*nW words, plane-major
+
+	// a + b + carryIn (carryIn is all-zeros or all-ones)
+	t_lanes add(const t_lanes& a, const t_lanes& b, uint64_t carryIn) const {
+		t_lanes out(width*nW);
+		t_lanes carry(nW, carryIn);
+		for (size_t p = 0; p < width; p++) {
+			const uint64_t* x = &a[p*nW];
+			const uint64_t* y = &b[p*nW];
+			uint64_t* s = &out[p*nW];
+			for (size_t w = 0; w < nW; w++) {
+				uint64_t xy = x[w] ^ y[w];
+				s[w] = xy ^ carry[w];
+				carry[w] = (x[w] & y[w]) | (carry[w] & xy);
+			}
+		}
+		return out;
+	}
+
+	t_lanes evalInt(const CNode& n) const {
+		t_lanes out(width*nW, 0);
+		switch (n.op) {
+			case CMOp::Const:
+				for (size_t p = 0; p < width; p++) {
+					bool bit = (n.value >> std::min<size_t>(p, 30)) & 1;
+					std::fill_n(&out[p*nW], nW, bit ? ~uint64_t(0) : 0);
+				}
+				break;
+			case CMOp::Card: {
+				// Adds the membership bit of each entity
+				// to a bit-sliced counter
+				t_lanes set = evalSet(*n.kids[0]);
+				t_lanes carry(nW);
+				for (size_t j = 0; j < N; j++) {
+					std::copy_n(&set[j*nW], nW, carry.begin());
+					for (size_t p = 0; p < width; p++) {
+						uint64_t* plane = &out[p*nW];
+						for (size_t w = 0; w < nW; w++) {
+							uint64_t t = plane[w] & carry[w];
+							plane[w] ^= carry[w];
+							carry[w] = t;
+						}
+					}
+				}
+				break;
+			}
+			case CMOp::Plus:
+				return add(evalInt(*n.kids[0]), evalInt(*n.kids[1]), 0);
+			case CMOp::Minus: {
+				t_lanes b = evalInt(*n.kids[1]);
+				for (auto& x : b) x = ~x;
+				return add(evalInt(*n.kids[0]), b, ~uint64_t(0));
+			}
+			default:
+				throw std::runtime_error(
+					"Cannot evaluate as an int: " + cmopToString(n.op));
+		}
+		return out;
+	}
+
+	///// Bools: nW words of values and nW words of definedness
+
+	LaneBool evalBool(const CNode& n) const {
+		LaneBool out{t_lanes(nW), t_lanes(nW, ~uint64_t(0))};
+		switch (n.op) {
+			case CMOp::BoolConst:
+				std::fill(out.value.begin(), out.value.end(),
+						n.value ? ~uint64_t(0) : 0);
+				break;
+			case CMOp::IntEq: {
+				t_lanes a = evalInt(*n.kids[0]);
+				t_lanes b = evalInt(*n.kids[1]);
+				std::fill(out.value.begin(), out.value.end(), ~uint64_t(0));
+				for (size_t i = 0; i < width*nW; i++) {
+					out.value[i % nW] &= ~(a[i] ^ b[i]);
+				}
+				break;
+			}
+			case CMOp::IntGt: {
+				// a > b iff b - a is negative
+				t_lanes a = evalInt(*n.kids[0]);
+				t_lanes b = evalInt(*n.kids[1]);
+				for (auto& x : a) x = ~x;
+				t_lanes diff = add(b, a, ~uint64_t(0));
+				std::copy_n(&diff[(width-1)*nW], nW, out.value.begin());
+				break;
+			}
+			case CMOp::Not: {
+				LaneBool a = evalBool(*n.kids[0]);
+				for (size_t w = 0; w < nW; w++) out.value[w] = ~a.value[w];
+				out.defined = a.defined;
+				break;
+			}
+			case CMOp::And:
+			case CMOp::Or: {
+				LaneBool a = evalBool(*n.kids[0]);
+				LaneBool b = evalBool(*n.kids[1]);
+				for (size_t w = 0; w < nW; w++) {
+					out.value[w] = n.op == CMOp::And ?
+						a.value[w] & b.value[w] :
+						a.value[w] | b.value[w];
+					out.defined[w] = a.defined[w] & b.defined[w];
+				}
+				break;
+			}
+			case CMOp::IfElse: {
+				LaneBool x = evalBool(*n.kids[0]);
+				LaneBool y = evalBool(*n.kids[1]);
+				LaneBool z = evalBool(*n.kids[2]);
+				for (size_t w = 0; w < nW; w++) {
+					out.value[w] =
+						(x.value[w] & y.value[w]) | (~x.value[w] & z.value[w]);
+					out.defined[w] = x.defined[w] & y.defined[w] & z.defined[w];
+				}
+				break;
+			}
+			case CMOp::Presup: {
+				LaneBool cond = evalBool(*n.kids[0]);
+				LaneBool v = evalBool(*n.kids[1]);
+				for (size_t w = 0; w < nW; w++) {
+					out.value[w] = v.value[w];
+					out.defined[w] =
+						cond.value[w] & cond.defined[w] & v.defined[w];
+				}
+				break;
+			}
+			default:
+				throw std::runtime_error(
+					"Cannot evaluate as a bool: " + cmopToString(n.op));
+		}
+		return out;
+	}
+
+public:
+
+	LaneEvaluator(const ObservedContext& oc, size_t width) :
+		N(oc.size()), nW(laneWords(oc.size())), width(width), oc(oc) {}
+
+	// Lanes of the variations where the meaning is true
+	// (and has no presupposition failure)
+	t_lanes trueLanes(const CNode& meaning) const {
+		LaneBool b = evalBool(meaning);
+		for (size_t w = 0; w < nW; w++) {
+			b.value[w] &= b.defined[w] & validLanes(N, w);
+		}
+		return b.value;
+	}
+};
+
+// Evaluates a compiled sentence meaning in all the
+// target variations of the observed context at once.
+// The caller checks that the context and the ints
+// fit in lanes of the given width.
+void evaluateLanes(
+		const CNode& meaning,
+		const ObservedContext& oc,
+		size_t width,
+		ListenerPosterior& post
+	) {
+
+	const size_t N = oc.size();
+	LaneEvaluator evaluator(oc, width);
+	std::vector<uint64_t> lanes = evaluator.trueLanes(meaning);
+
+	post.nVariations = std::ldexp(1.0, N);
+	post.observedTrue =
+		(lanes[oc.observedTargets >> 6] >> (oc.observedTargets & 63)) & 1;
+
+	size_t nTrue = 0;
+	for (auto w : lanes) nTrue += std::popcount(w);
+	post.nTrue = nTrue;
+
+	// Number of true variations where each entity is a target
+	post.marginals.assign(N, 0);
+	for (size_t j = 0; j < N; j++) {
+		size_t count = 0;
+		for (size_t w = 0; w < lanes.size(); w++) {
+			count += std::popcount(lanes[w] & targetLanes(j, w));
+		}
+		post.marginals[j] = (double)count / nTrue;
+	}
+}
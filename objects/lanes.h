@@ -0,0 +1,149 @@
+# pragma once
+
+// Lane-parallel evaluation of compiled meanings.
+// The target variations of an observed context differ only in
+// the target bit of each entity. Variation k gives entity j the
+// target bit (k >> j) & 1, exactly as in generateContextVariations.
+// Each variation is one bit ("lane") of a 64-bit word, so every
+// operation of a compiled meaning is applied to 64 variations
+// at once. Contexts with more than 6 entities use several words
+// per value, and the loops over words are auto-vectorized.
+
+// Contexts larger than this are never evaluated with lanes,
+// since the number of lanes grows as 2^N and a value would not
+// fit in the cache. Below it, lanes are used when they are
+// cheaper than counting (see Agent::evaluateMeaning)
+const size_t maxLaneContextSize = 20;
+
+// The listener's view of a context: the ints of the entities
+// (in the order of the t_context) and their signatures.
+struct ObservedContext {
+	std::vector<int> ints;
+	std::vector<t_signature> signatures;
+	// The actual target bits of the entities (bit j is entity j).
+	// The listener does not use them, but they identify
+	// the observed variation.
+	uint64_t observedTargets = 0;
+	// Same, for contexts of any size
+	std::vector<uint8_t> targets;
+
+	size_t size() const { return ints.size(); }
+};
+
+ObservedContext observeContext(const t_context& c) {
+	ObservedContext oc;
+	size_t j = 0;
+	for (const auto& e : c) {
+		oc.ints.push_back(std::get<0>(e));
+		oc.signatures.push_back(featureSignature(std::get<0>(e)));
+		oc.targets.push_back(std::get<1>(e));
+		if (std::get<1>(e) && j < 64) {
+			oc.observedTargets |= uint64_t(1) << j;
+		}
+		j++;
+	}
+	return oc;
+}
+
+// Everything the literal listener infers from
+// a sentence in an observed context
+struct ListenerPosterior {
+	// Whether the sentence is true in the observed context
+	bool observedTrue = false;
+	// Number of target variations where the sentence is true
+	double nTrue = 0;
+	// Number of target variations (2^N)
+	double nVariations = 1;
+	// P(entity i is a target | sentence is true)
+	std::vector<double> marginals;
+	// Number of sampled variations for Monte Carlo estimates
+	// (then nTrue and nVariations count sampled variations),
+	// 0 if the posterior is exact
+	size_t nSamples = 0;
+
+	// Surprisal of the sentence being true
+	// against the set of all possible alternatives
+	double informativity() const {
+		return -std::log(nTrue/nVariations);
+	}
+
+	// Confidence interval of the informativity,
+	// from the Wilson score interval of the proportion of
+	// true variations. z = 1.96 gives a 95% interval.
+	// Exact posteriors have an interval of width 0.
+	std::pair<double,double> informativityInterval(double z = 1.96) const {
+		if (nSamples == 0) return {informativity(), informativity()};
+		double n = nVariations;
+		double p = nTrue/n;
+		double center = (p + z*z/(2*n)) / (1 + z*z/n);
+		double half = z*std::sqrt(p*(1-p)/n + z*z/(4*n*n)) / (1 + z*z/n);
+		return {
+			-std::log(std::min(1.0, center + half)),
+			-std::log(std::max(0.0, center - half))
+		};
+	}
+
+	// Half-width of that interval (0 if exact)
+	double informativityError(double z = 1.96) const {
+		auto [low, high] = informativityInterval(z);
+		return (high - low) / 2;
+	}
+};
+
+// Number of 64-bit words needed to hold one lane per variation
+size_t laneWords(size_t N) {
+	return N <= 6 ? 1 : size_t(1) << (N - 6);
+}
+
+// Lanes (within word w) of the variations where entity j is a target
+uint64_t targetLanes(size_t j, size_t w) {
+	static const uint64_t patterns[6] = {
+		0xAAAAAAAAAAAAAAAAULL,
+		0xCCCCCCCCCCCCCCCCULL,
+		0xF0F0F0F0F0F0F0F0ULL,
+		0xFF00FF00FF00FF00ULL,
+		0xFFFF0000FFFF0000ULL,
+		0xFFFFFFFF00000000ULL
+	};
+	if (j < 6) return patterns[j];
+	return ((w >> (j - 6)) & 1) ? ~uint64_t(0) : 0;
+}
+
+// Lanes of word w that correspond to an actual variation
+uint64_t validLanes(size_t N, size_t w) {
+	if (N >= 6) return ~uint64_t(0);
+	return (uint64_t(1) << (size_t(1) << N)) - 1;
+}
+
+// Upper bound of the absolute value of an int node
+// in a context of size N
+long intBound(const CNode& n, size_t N) {
+	switch (n.op) {
+		case CMOp::Const: return std::abs(n.value);
+		case CMOp::Card:  return N;
+		case CMOp::Plus:
+		case CMOp::Minus:
+			return intBound(*n.kids[0], N) + intBound(*n.kids[1], N);
+		default: {
+			long bound = 0;
+			for (auto& k : n.kids) {
+				bound = std::max(bound, intBound(*k, N));
+			}
+			return bound;
+		}
+	}
+}
+
+// Ints are bit-sliced in two's complement: plane p holds
+// bit p of the int in every lane. Planes wider than this
+// are not worth it, and the meaning is evaluated otherwise.
+const size_t maxLaneIntWidth = 16;
+
+// Bit width that holds every int in the meaning
+// and the difference of any two of them
+size_t laneIntWidth(const CNode& n, size_t N) {
+	long bound = 2*intBound(n, N);
+	size_t width = 1;
+	while ((long(1) << (width - 1)) <= bound) width++;
+	return width;
+}
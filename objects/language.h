@@ -39,6 +39,39 @@ std::string meaningTypeToString(const t_meaning& meaning) {
     }, meaning);
 }
 
+bool isPrime(int o) {
+	if (o <= 1) return false;
+	if (o == 2) return true;
+	if (o % 2 == 0) return false;
+	for (int i = 3; i < o; i += 2) {
+		if (o % i == 0) return false;
+	}
+	return true;
+}
+
+// The lexical predicates that do not depend on target status.
+// Two ints with the same signature over these predicates
+// cannot be told apart by any word in the lexicon
+// (apart from the TVs, which compare ints directly).
+// The position in the vector is the bit in the signature.
+const std::vector<std::string> lexicalFeatures = {
+	"positive", "negative", "even", "prime",
+	"0", "1", "2", "3", "4", "5"
+};
+
+// Bitmask of the lexicalFeatures that are true of an int
+using t_signature = uint16_t;
+
+t_signature featureSignature(int o) {
+	t_signature sig = 0;
+	sig |= (o > 0)       << 0;
+	sig |= (o < 0)       << 1;
+	sig |= (o % 2 == 0)  << 2;
+	sig |= isPrime(o)    << 3;
+	if (o >= 0 && o < 6) sig |= 1 << (4 + o);
+	return sig;
+}
+
 // Define a class to hold the lexical meanings
 class LexicalSemantics {
 
@@ -185,14 +218,7 @@ public:
 		add( "prime",
 			[](t_context c) -> t_IV {
 				return [](t_e x) -> t_t {
-					int o = std::get<0>(x);
-					if (o <= 1) return false;
-					if (o == 2) return true;
-					if (o % 2 == 0) return false;
-					for (int i = 3; i < o; i += 2) {
-						if (o % i == 0) return false;
-					}
-					return true;
+					return isPrime(std::get<0>(x));
 				};
 			}
 		);
@@ -0,0 +1,159 @@
+# pragma once
+
+// Approximate listener for contexts where no exact method is
+// affordable, e.g. large contexts with meanings that are not
+// permutation-invariant (so counting does not apply).
+// Target variations are sampled uniformly, so the proportion of
+// sampled variations where the sentence is true estimates
+// nTrue/2^N, and the targets among them estimate the marginals.
+// Sampling stops when the informativity is known to within
+// maxError, or after the budget is spent,
+// so the cost per sentence is bounded.
+
+struct MonteCarloSettings {
+	// Maximum number of sampled variations per sentence.
+	// Exact methods are used when they are cheaper than this
+	size_t budget = 10000;
+	// Target half-width of the confidence interval
+	// of the informativity (in nats)
+	double maxError = 0.05;
+	// z-score of the confidence interval (1.96 is 95%)
+	double z = 1.96;
+};
+
+// The sampling settings of new agents.
+// Only change them at startup, like the listener mode.
+MonteCarloSettings defaultMonteCarlo;
+
+// How precise the sampled informativities of a run were,
+// reported at the end of the run (see Main.cpp)
+class MonteCarloSummary {
+private:
+
+	mutable std::mutex mutex;
+	size_t nSentences = 0;
+	size_t nSamples = 0;
+	double sumError = 0;
+	double maxError = 0;
+
+public:
+
+	void record(const ListenerPosterior& post, double z) {
+		double error = post.informativityError(z);
+		std::lock_guard<std::mutex> lock(mutex);
+		nSentences++;
+		nSamples += post.nSamples;
+		sumError += error;
+		maxError = std::max(maxError, error);
+	}
+
+	bool empty() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return nSentences == 0;
+	}
+
+	// Mean and largest half-width of the confidence
+	// intervals of the informativity
+	void report(std::ostream& os, double z) const {
+		std::lock_guard<std::mutex> lock(mutex);
+		os << "Monte Carlo listener: " << nSentences << " sentences, "
+			<< double(nSamples) / std::max(nSentences, size_t(1))
+			<< " samples each, informativity +- "
+			<< sumError / std::max(nSentences, size_t(1))
+			<< " nats on average, +- " << maxError << " at most (z = "
+			<< z << ")" << std::endl;
+	}
+};
+
+MonteCarloSummary monteCarloSummary;
+
+// Seeds the sampler from the ints of the context only,
+// so the listener samples the same variations for
+// every sentence in a context (common random numbers),
+// and results do not depend on threads or call order
+uint64_t monteCarloSeed(const ObservedContext& oc) {
+	uint64_t seed = 0x9E3779B97F4A7C15ULL;
+	for (int i : oc.ints) {
+		seed ^= uint64_t(uint32_t(i)) + 0x9E3779B97F4A7C15ULL
+			+ (seed << 6) + (seed >> 2);
+	}
+	return seed;
+}
+
+// Samples variations with an incremental evaluator
+// (IncrementalMeaning or IncrementalContext): going from one
+// sample to the next flips the entities whose target bit changes.
+// A sentence that is true in none of the sampled variations says
+// nothing about where the targets are, as far as the samples go:
+// the exact listener is used for it if the caller has one,
+// otherwise every entity is a target with probability 0.5
+template <typename Evaluator>
+ListenerPosterior monteCarloListener(
+		const ObservedContext& oc,
+		Evaluator& evaluator,
+		const MonteCarloSettings& settings,
+		const std::function<ListenerPosterior()>& exact = nullptr
+	) {
+
+	const size_t N = oc.size();
+	std::mt19937_64 rng(monteCarloSeed(oc));
+
+	// the evaluator starts with every entity as a distractor
+	std::vector<uint8_t> targets(N, 0);
+	size_t n = 0;
+	size_t nTrue = 0;
+	std::vector<double> counts(N, 0);
+	while (n < settings.budget) {
+		uint64_t bits = 0;
+		for (size_t j = 0; j < N; j++) {
+			if (j % 64 == 0) bits = rng();
+			bool target = (bits >> (j % 64)) & 1;
+			if (target != targets[j]) {
+				targets[j] = target;
+				evaluator.flip(j, target);
+			}
+		}
+		std::optional<bool> v = evaluator.value();
+		n++;
+		if (v.has_value() && *v) {
+			nTrue++;
+			for (size_t j = 0; j < N; j++) counts[j] += targets[j];
+		}
+		// check the error now and then (delta method on -log p)
+		if (n % 64 == 0 && nTrue > 0) {
+			double p = (double)nTrue/n;
+			double error = settings.z * std::sqrt((1-p)/(n*p));
+			if (error <= settings.maxError) break;
+		}
+	}
+
+	ListenerPosterior post;
+	for (size_t j = 0; j < N; j++) {
+		if (targets[j] != oc.targets[j]) {
+			evaluator.flip(j, oc.targets[j]);
+		}
+	}
+	std::optional<bool> observed = evaluator.value();
+	post.observedTrue = observed.has_value() && *observed;
+
+	post.nSamples = n;
+	post.nVariations = n;
+	post.nTrue = nTrue;
+	// A sentence that is true in the observed context
+	// is true in at least one variation
+	if (post.observedTrue) {
+		post.nTrue = std::max(post.nTrue, n*std::ldexp(1.0, -(int)N));
+	}
+	if (nTrue == 0) {
+		if (exact) return exact();
+		monteCarloSummary.record(post, settings.z);
+		post.marginals.assign(N, 0.5);
+		return post;
+	}
+	monteCarloSummary.record(post, settings.z);
+	post.marginals.assign(N, 0);
+	for (size_t j = 0; j < N; j++) {
+		post.marginals[j] = counts[j] / nTrue;
+	}
+	return post;
+}
@@ -0,0 +1,287 @@
+# pragma once
+
+// The Pareto frontier of simplicity (prior) and communicative
+// accuracy, over every hypothesis whose likelihood was computed
+// by any chain. This is the tradeoff curve of the analysis,
+// so it can be read directly instead of being reconstructed
+// from the full dump of samples in hyp.csv.
+// It is kept as a staircase: going down in prior,
+// the accuracy goes strictly up. A hypothesis is on the
+// frontier if no other one is at least as simple and
+// at least as accurate.
+// The accuracy a chain computes is an estimate on the contexts it
+// happened to use, which change from one evaluation to the next.
+// A staircase of the best estimates would keep the luckiest draw of
+// every hypothesis, and overstate the curve. So the hypotheses that
+// would make it to the frontier are scored again on one fixed set of
+// reference contexts, and the frontier is made of those scores.
+// They are queued and scored together, a batch at a time (see
+// Agent::evaluateBatch), when the queue is full or the frontier is
+// written. This is not a likelihood: it does not count as contexts used
+// by the chains, nor go through the caches of the thread that happens
+// to score it, which belong to the hypotheses of its chain.
+
+class ParetoFrontier {
+private:
+
+	struct Point {
+		double commAcc;
+		std::string hypothesis;
+		std::string serialized;
+	};
+
+	// A hypothesis waiting to be scored on the reference contexts
+	struct Candidate {
+		double prior;
+		std::string hypothesis;
+		std::string serialized;
+	};
+
+	// candidates scored at a time
+	static constexpr size_t rescoreBatch = 32;
+
+	// from the highest prior to the lowest
+	std::map<double, Point, std::greater<double>> points;
+	mutable std::mutex mutex;
+	std::filesystem::path path;
+	// seconds between writes (0 only writes when asked)
+	double writeEvery = 0;
+	std::chrono::steady_clock::time_point lastWrite;
+	// hypotheses offered, and added
+	size_t nOffered = 0;
+	size_t nAdded = 0;
+	// the reference contexts, drawn from referenceSeed
+	// the first time they are needed
+	uint64_t referenceSeed = 0;
+	std::once_flag referenceDrawn;
+	std::vector<PooledContext> reference;
+	// accuracies on the reference contexts, by program
+	SharedCache<double> rescored{1 << 14};
+	// candidates not scored yet, and their programs
+	std::vector<Candidate> queue;
+	std::set<std::string> queued;
+	// scores programs on the reference contexts, for
+	// the type of hypothesis that was offered first
+	std::function<std::vector<double>(const std::vector<std::string>&)> scorer;
+
+	// Hypotheses that can be built from their programs
+	// and scored on the reference contexts
+	template <typename Hyp>
+	static constexpr bool rescorable = requires (
+			std::vector<Hyp>& hs,
+			const std::vector<PooledContext>& cs
+		) {
+		Hyp(std::string());
+		Hyp::makeContextPool(0);
+		Hyp::referenceCommAccs(hs, cs);
+	};
+
+	// Call with the lock held
+	template <typename Hyp>
+	void useScorer() {
+		if (scorer) return;
+		scorer = [this](const std::vector<std::string>& programs) {
+			std::call_once(referenceDrawn, [&] {
+				reference = Hyp::makeContextPool(referenceSeed).next();
+			});
+			std::vector<Hyp> hs;
+			for (auto& p : programs) hs.emplace_back(p);
+			return Hyp::referenceCommAccs(hs, reference);
+		};
+	}
+
+	// Scores candidates taken off the queue and adds them.
+	// The lock is not held while they are scored
+	void rescore(std::vector<Candidate> candidates) {
+		if (candidates.empty()) return;
+		std::vector<std::string> programs;
+		for (auto& c : candidates) programs.push_back(c.serialized);
+		std::vector<double> scores = scorer(programs);
+		std::lock_guard lock(mutex);
+		for (size_t i = 0; i < candidates.size(); i++) {
+			Candidate& c = candidates[i];
+			rescored.insert(c.serialized, scores[i]);
+			queued.erase(c.serialized);
+			insertLocked(c.prior, scores[i], c.hypothesis, c.serialized);
+		}
+	}
+
+	// Takes the whole queue
+	std::vector<Candidate> takeQueue() {
+		std::lock_guard lock(mutex);
+		return std::exchange(queue, {});
+	}
+
+	bool dominated(double prior, double commAcc) const {
+		// the least accurate point at least as simple
+		auto it = points.lower_bound(prior);
+		if (it != points.begin()) {
+			auto simpler = std::prev(it);
+			if (simpler->second.commAcc >= commAcc) return true;
+		}
+		return it != points.end() && it->first == prior
+			&& it->second.commAcc >= commAcc;
+	}
+
+	void insertLocked(
+			double prior,
+			double commAcc,
+			const std::string& hypothesis,
+			const std::string& serialized
+		) {
+		if (std::isnan(commAcc) || commAcc == -infinity) return;
+		if (dominated(prior, commAcc)) return;
+		nAdded++;
+		// remove the points the new one dominates:
+		// not simpler, and not more accurate
+		auto it = points.lower_bound(prior);
+		while (it != points.end() && it->second.commAcc <= commAcc) {
+			it = points.erase(it);
+		}
+		points[prior] = Point{commAcc, hypothesis, serialized};
+	}
+
+	bool writeDue() const {
+		std::chrono::duration<double> elapsed =
+			std::chrono::steady_clock::now() - lastWrite;
+		return writeEvery > 0 && elapsed.count() >= writeEvery;
+	}
+
+	void writeLocked() {
+		std::filesystem::path tmp = path;
+		tmp += ".tmp";
+		{
+			std::ofstream file(tmp);
+			file.precision(17);
+			file << "prior,commacc,hypothesis,serialized" << std::endl;
+			for (auto& [prior, p] : points) {
+				file
+					<< prior
+					<< "," << p.commAcc
+					<< "," << p.hypothesis
+					<< "," << p.serialized
+					<< std::endl;
+			}
+		}
+		std::filesystem::rename(tmp, path);
+		lastWrite = std::chrono::steady_clock::now();
+	}
+
+public:
+
+	// Only call it at startup
+	void open(const std::filesystem::path& p, double seconds, uint64_t seed) {
+		path = p;
+		writeEvery = seconds;
+		referenceSeed = seed;
+		lastWrite = std::chrono::steady_clock::now();
+	}
+
+	bool enabled() const { return !path.empty(); }
+
+	// Offers h, with the accuracy a chain estimated for it
+	template <typename Hyp>
+	void add(double prior, double commAcc, const Hyp& h) {
+		if (!enabled() || std::isnan(prior) || std::isnan(commAcc)) return;
+		if (prior == -infinity || commAcc == -infinity) return;
+		std::vector<Candidate> full;
+		bool due = false;
+		{
+			std::lock_guard lock(mutex);
+			nOffered++;
+			// hypotheses that can be scored again are, if their
+			// estimate would put them on the frontier
+			if constexpr (rescorable<Hyp>) {
+				if (dominated(prior, commAcc)) return;
+				useScorer<Hyp>();
+				std::string key = h.serialize();
+				if (auto hit = rescored.find(key)) {
+					insertLocked(prior, *hit, h.string(), key);
+				} else if (queued.insert(key).second) {
+					queue.push_back(Candidate{prior, h.string(), key});
+					if (queue.size() >= rescoreBatch) full = std::exchange(queue, {});
+				}
+			} else {
+				insertLocked(prior, commAcc, h.string(), h.serialize());
+			}
+			due = writeDue();
+		}
+		rescore(std::move(full));
+		if (due) write();
+	}
+
+	// Scores what is queued and writes the frontier
+	void write() {
+		if (!enabled()) return;
+		rescore(takeQueue());
+		std::lock_guard lock(mutex);
+		writeLocked();
+	}
+
+	// For checkpoints (see checkpoint.h)
+	void save(std::ostream& os) const {
+		std::lock_guard lock(mutex);
+		writeValue(os, uint64_t(referenceSeed));
+		writeValue(os, uint64_t(nOffered));
+		writeValue(os, uint64_t(nAdded));
+		writeValue(os, uint64_t(points.size()));
+		for (auto& [prior, p] : points) {
+			writeValue(os, prior);
+			writeValue(os, p.commAcc);
+			writeValue(os, p.hypothesis);
+			writeValue(os, p.serialized);
+		}
+		// the queue is scored after a resume as it would have been
+		writeValue(os, uint64_t(queue.size()));
+		for (auto& c : queue) {
+			writeValue(os, c.prior);
+			writeValue(os, c.hypothesis);
+			writeValue(os, c.serialized);
+		}
+	}
+
+	template <typename Hyp>
+	void load(std::istream& is) {
+		std::lock_guard lock(mutex);
+		if constexpr (rescorable<Hyp>) useScorer<Hyp>();
+		// the points were scored on the contexts of this seed
+		referenceSeed = readSize(is);
+		nOffered = readSize(is);
+		nAdded = readSize(is);
+		points.clear();
+		size_t n = readSize(is);
+		for (size_t i = 0; i < n; i++) {
+			double prior = readDouble(is);
+			Point p;
+			p.commAcc = readDouble(is);
+			p.hypothesis = readString(is);
+			p.serialized = readString(is);
+			points[prior] = p;
+		}
+		queue.clear();
+		queued.clear();
+		n = readSize(is);
+		for (size_t i = 0; i < n; i++) {
+			Candidate c;
+			c.prior = readDouble(is);
+			c.hypothesis = readString(is);
+			c.serialized = readString(is);
+			queued.insert(c.serialized);
+			queue.push_back(c);
+		}
+	}
+
+	size_t size() const {
+		std::lock_guard lock(mutex);
+		return points.size();
+	}
+
+	size_t offered() const {
+		std::lock_guard lock(mutex);
+		return nOffered;
+	}
+};
+
+// The frontier of the run, written to frontier.csv
+// in the run folder (see --frontierevery)
+ParetoFrontier paretoFrontier;
@@ -0,0 +1,82 @@
+# pragma once
+
+// What the agent can see of a hypothesis, read off its compiled
+// parts before running anything (see QuantsHypothesis::likelihoodOn).
+// The agent only uses the quantifiers through the composition rule,
+// so many sampled hypotheses differ in parts that make no difference:
+//  - a rule that never applies X.Q (e.g. ( intGt ( cardinality X.L ) 1 ))
+//    gives every [Q IV] the same meaning, whatever Q1, Q2 and Q3 are,
+//  - a quantifier that never looks at the context, like ( intGt 1 0 ),
+//    is just true or false, however it is written.
+// Two hypotheses with the same key give every sentence the same
+// compiled meaning, so on the same contexts they have the same
+// data and the same communicative accuracy.
+
+// Whether op appears anywhere in n
+bool mentionsOp(const CNode& n, CMOp op) {
+	if (n.op == op) return true;
+	for (auto& k : n.kids) {
+		if (mentionsOp(*k, op)) return true;
+	}
+	return false;
+}
+
+// The value of a meaning that does not depend on
+// anything, or nothing if it does
+std::optional<int> constantValue(const CNode& n) {
+	auto kid = [&](size_t i) { return constantValue(*n.kids[i]); };
+	switch (n.op) {
+		case CMOp::Const:
+		case CMOp::BoolConst:
+			return n.value;
+		case CMOp::Not: {
+			auto a = kid(0);
+			if (!a) return std::nullopt;
+			return int(!*a);
+		}
+		case CMOp::Plus: case CMOp::Minus:
+		case CMOp::IntEq: case CMOp::IntGt:
+		case CMOp::And: case CMOp::Or: {
+			auto a = kid(0), b = kid(1);
+			if (!a || !b) return std::nullopt;
+			switch (n.op) {
+				case CMOp::Plus: 	return *a + *b;
+				case CMOp::Minus: 	return *a - *b;
+				case CMOp::IntEq: 	return int(*a == *b);
+				case CMOp::IntGt: 	return int(*a > *b);
+				case CMOp::And: 	return int(*a && *b);
+				default: 			return int(*a || *b);
+			}
+		}
+		default:
+			return std::nullopt;
+	}
+}
+
+// The key of the behaviour of a hypothesis with these parts
+std::string behaviourKey(const CompiledSemantics& sem) {
+	std::string key = sem.compRule ? cnodeToString(sem.compRule) : "application";
+	// the quantifiers are never applied
+	if (sem.compRule && !mentionsOp(*sem.compRule, CMOp::QApply)) {
+		return key;
+	}
+	for (auto& [word, q] : sem.quantifiers) {
+		auto value = constantValue(*q);
+		key += "|" + word + "=" +
+			(value ? (*value ? "true" : "false") : cnodeToString(q));
+	}
+	return key;
+}
+
+// The contexts, with the seeds of the speaker
+std::string contextsKey(const std::vector<PooledContext>& cs) {
+	std::string key;
+	for (auto& c : cs) {
+		key += std::to_string(c.seed) + ":";
+		for (auto& [i, target] : c.context) {
+			key += std::to_string(i) + (target ? "+" : "-");
+		}
+		key += ";";
+	}
+	return key;
+}
@@ -0,0 +1,119 @@
+# pragma once
+
+// A proposal that knows the four parts of a QuantsHypothesis:
+// the composition rule and the three quantifiers.
+// Fleet's proposals regenerate a subtree anywhere in the program,
+// so a step often rewrites a large part of it at once. This one
+// picks one of the four parts uniformly, then a node of that part
+// uniformly, and regenerates the subtree below it from the grammar.
+// The other three parts are untouched, so everything the agent
+// derived from them is still valid: their compiled meanings (see
+// QuantsHypothesis::compileSemantics) and the listener's results for
+// the sentences that do not mention the changed part, which are
+// found again in the shared caches by their meaning (see agent.h).
+// The proposal is symmetric in the choice of the part, so
+//   fb = log(1/n(x)) + log P(new subtree) - log(1/n(y)) - log P(old subtree)
+// where n is the number of nodes of the changed part.
+// It works on the serialized program, so it only needs
+// the rules of the grammar and Hyp(serialized).
+
+// Probability of proposing with this kernel instead of
+// Fleet's own proposal (0 is never)
+double componentProposals = 0;
+
+// Back to the format of Hypothesis::serialize()
+std::string serializeProgram(const ProgramNode& n) {
+	std::string out = std::to_string(n.nt) + ":" + n.format;
+	for (auto& k : n.kids) out += ";" + serializeProgram(k);
+	return out;
+}
+
+size_t countNodes(const ProgramNode& n) {
+	size_t count = 1;
+	for (auto& k : n.kids) count += countNodes(k);
+	return count;
+}
+
+// The i-th node of a tree in preorder
+ProgramNode& nthNode(ProgramNode& n, size_t& i) {
+	if (i == 0) return n;
+	i--;
+	for (auto& k : n.kids) {
+		size_t size = countNodes(k);
+		if (i < size) return nthNode(k, i);
+		i -= size;
+	}
+	throw std::runtime_error("Node index out of range");
+}
+
+template <typename Grammar>
+class ComponentProposal {
+private:
+
+	const Grammar& grammar;
+	size_t maxDepth;
+
+	double normalizer(nonterminal_t nt) const {
+		double z = 0;
+		for (auto& r : grammar.rules[nt]) z += r.p;
+		return z;
+	}
+
+	// Log probability of generating the tree from its nonterminal
+	double logProbability(const ProgramNode& n) const {
+		for (auto& r : grammar.rules[n.nt]) {
+			if (r.format != n.format) continue;
+			double lp = std::log(r.p) - std::log(normalizer(n.nt));
+			for (auto& k : n.kids) lp += logProbability(k);
+			return lp;
+		}
+		throw std::runtime_error("No rule " + n.format);
+	}
+
+	// A tree of nt from the grammar, or nothing if it gets too deep
+	template <typename RNG>
+	std::optional<ProgramNode> generate(nonterminal_t nt, size_t depth, RNG& rng) const {
+		if (depth > maxDepth) return std::nullopt;
+		std::vector<double> ps;
+		for (auto& r : grammar.rules[nt]) ps.push_back(r.p);
+		const auto& r = grammar.rules[nt][
+			std::discrete_distribution<size_t>(ps.begin(), ps.end())(rng)];
+		ProgramNode n{int(nt), r.format};
+		for (size_t i = 0; i < r.N; i++) {
+			auto k = generate(r.type(i), depth + 1, rng);
+			if (!k) return std::nullopt;
+			n.kids.push_back(std::move(*k));
+		}
+		return n;
+	}
+
+public:
+
+	ComponentProposal(const Grammar& grammar, size_t maxDepth) :
+		grammar(grammar), maxDepth(maxDepth) {}
+
+	// The serialized proposal and its fb, or nothing if the
+	// regenerated subtree got too deep (a rejected step)
+	template <typename RNG>
+	std::optional<std::pair<std::string, double>> propose(
+			const std::string& serialized,
+			RNG& rng
+		) const {
+		ProgramNode program = parseSerializedProgram(serialized);
+		if (program.kids.empty()) return std::nullopt;
+		size_t part = std::uniform_int_distribution<size_t>(
+			0, program.kids.size() - 1)(rng);
+		ProgramNode& component = program.kids[part];
+		size_t before = countNodes(component);
+		size_t i = std::uniform_int_distribution<size_t>(0, before - 1)(rng);
+		ProgramNode& node = nthNode(component, i);
+
+		auto fresh = generate(node.nt, 0, rng);
+		if (!fresh) return std::nullopt;
+		double fb = logProbability(*fresh) - logProbability(node)
+			- std::log(double(before));
+		node = std::move(*fresh);
+		fb += std::log(double(countNodes(component)));
+		return std::make_pair(serializeProgram(program), fb);
+	}
+};
@@ -0,0 +1,162 @@
+# pragma once
+
+// Rewrites of the parts of a QuantsHypothesis that do not change
+// what they mean. The grammar has many ways of writing the same
+// thing, e.g. ( not ( not x ) ), ( + 0 x ), ( intGt 1 0 ) or
+// ( and y x ) for ( and x y ), and the sampler finds all of them.
+// simplifyProgram rewrites a program bottom-up:
+//  - constants are folded: an int that is 0 or 1 becomes that
+//    terminal, and a constant bool becomes ( intEq 0 0 ) if true
+//    or ( intGt 0 0 ) if false (the grammar has no true and false),
+//  - ( not ( not x ) ) is x, ( + 0 x ) and ( - x 0 ) are x,
+//    ( - x x ) is 0, ( intEq x x ) is true, ( intGt x x ) is false,
+//    ( and x x ), ( or x x ), ( union x x ), ( intersection x x ) are x,
+//    ( and true x ) and ( or false x ) are x,
+//  - the arguments of the commutative operators are sorted.
+// Programs with the same canonical form mean the same thing, so
+// the canonical form is a key for what only depends on the meaning
+// (e.g. the likelihood, see speculative.h), and it is the
+// program that gets compiled (see QuantsHypothesis::compileSemantics).
+// The prior is always computed on the original program.
+
+namespace simplify {
+
+	const std::string trueFormat = "( intEq %s %s )";
+	const std::string falseFormat = "( intGt %s %s )";
+
+	const std::set<std::string> commutative = {
+		"( and %s %s )",
+		"( or %s %s )",
+		"( intEq %s %s )",
+		"( + %s %s )",
+		"( union %s %s )",
+		"( intersection %s %s )"
+	};
+
+	const std::set<std::string> idempotent = {
+		"( and %s %s )",
+		"( or %s %s )",
+		"( union %s %s )",
+		"( intersection %s %s )"
+	};
+
+	const std::set<std::string> booleans = {
+		"( intEq %s %s )",
+		"( intGt %s %s )",
+		"( not %s )",
+		"( and %s %s )",
+		"( or %s %s )"
+	};
+
+	bool sameProgram(const ProgramNode& a, const ProgramNode& b) {
+		if (a.nt != b.nt || a.format != b.format) return false;
+		if (a.kids.size() != b.kids.size()) return false;
+		for (size_t i = 0; i < a.kids.size(); i++) {
+			if (!sameProgram(a.kids[i], b.kids[i])) return false;
+		}
+		return true;
+	}
+
+	// The value of a program that does not depend
+	// on anything, or nothing if it does
+	std::optional<int> programValue(const ProgramNode& n) {
+		const std::string& f = n.format;
+		if (f == "0" || f == "1") return std::stoi(f);
+		if (f == "( not %s )") {
+			auto a = programValue(n.kids[0]);
+			if (!a) return std::nullopt;
+			return int(!*a);
+		}
+		if (n.kids.size() != 2) return std::nullopt;
+		auto a = programValue(n.kids[0]);
+		auto b = programValue(n.kids[1]);
+		if (!a || !b) return std::nullopt;
+		if (f == "( + %s %s )") 	return *a + *b;
+		if (f == "( - %s %s )") 	return *a - *b;
+		if (f == "( intEq %s %s )") return int(*a == *b);
+		if (f == "( intGt %s %s )") return int(*a > *b);
+		if (f == "( and %s %s )") 	return int(*a && *b);
+		if (f == "( or %s %s )") 	return int(*a || *b);
+		return std::nullopt;
+	}
+
+	// The nonterminal of the ints that can be
+	// compared in the bool program n, if it has any
+	std::optional<int> intNonterminal(const ProgramNode& n) {
+		if (n.format == trueFormat || n.format == falseFormat) {
+			return n.kids[0].nt;
+		}
+		for (auto& k : n.kids) {
+			if (auto nt = intNonterminal(k)) return nt;
+		}
+		return std::nullopt;
+	}
+
+	ProgramNode intConstant(int nt, int value) {
+		return ProgramNode{nt, std::to_string(value)};
+	}
+
+	ProgramNode boolConstant(int nt, int intNt, bool value) {
+		return ProgramNode{nt, value ? trueFormat : falseFormat,
+			{intConstant(intNt, 0), intConstant(intNt, 0)}};
+	}
+
+}
+
+ProgramNode simplifyProgram(const ProgramNode& p) {
+	using namespace simplify;
+
+	ProgramNode n{p.nt, p.format};
+	for (auto& k : p.kids) n.kids.push_back(simplifyProgram(k));
+	const std::string& f = n.format;
+
+	if (commutative.count(f) &&
+			serializeProgram(n.kids[1]) < serializeProgram(n.kids[0])) {
+		std::swap(n.kids[0], n.kids[1]);
+	}
+
+	// constants
+	if (auto value = programValue(n)) {
+		if (!booleans.count(f)) {
+			if (*value == 0 || *value == 1) return intConstant(n.nt, *value);
+			return n;
+		}
+		// a bool is only written with the ints of its side
+		// of the grammar, so without them it stays as it is
+		if (auto intNt = intNonterminal(n)) {
+			return boolConstant(n.nt, *intNt, *value);
+		}
+		return n;
+	}
+
+	// identities
+	if (f == "( not %s )" && n.kids[0].format == "( not %s )") {
+		return n.kids[0].kids[0];
+	}
+	if (n.kids.size() != 2) return n;
+	bool same = sameProgram(n.kids[0], n.kids[1]);
+	if (idempotent.count(f) && same) return n.kids[0];
+	if (f == "( intEq %s %s )" && same) {
+		return boolConstant(n.nt, n.kids[0].nt, true);
+	}
+	if (f == "( intGt %s %s )" && same) {
+		return boolConstant(n.nt, n.kids[0].nt, false);
+	}
+	if (f == "( - %s %s )" && same) return intConstant(n.nt, 0);
+	if (f == "( - %s %s )" && programValue(n.kids[1]) == 0) return n.kids[0];
+	for (size_t i = 0; i < 2; i++) {
+		auto value = programValue(n.kids[i]);
+		if (!value) continue;
+		if ((f == "( + %s %s )" && *value == 0) ||
+				(f == "( and %s %s )" && *value) ||
+				(f == "( or %s %s )" && !*value)) {
+			return n.kids[1-i];
+		}
+	}
+	return n;
+}
+
+// The canonical form of a serialized program
+std::string canonicalProgram(const std::string& serialized) {
+	return serializeProgram(simplifyProgram(parseSerializedProgram(serialized)));
+}
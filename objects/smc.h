@@ -0,0 +1,171 @@
+# pragma once
+
+// Sequential Monte Carlo over the likelihood weight.
+// A population of particles starts as samples from the prior
+// (weight 0) and is moved along a path of weights up to
+// the weight of the run. At each generation:
+//  1. the next weight is the largest one at which the importance
+//     weights of the particles, exp((w' - w) * commAcc), keep an
+//     effective sample size of at least essFraction of the particles,
+//  2. the particles are resampled by those weights, and
+//  3. each particle takes a few MH steps at the new weight
+//     (rejuvenation), which brings back the diversity that
+//     resampling removed.
+// The particles are independent within a generation, so the
+// likelihoods of a generation are one batch spread over all the
+// threads, however few chains there would be. After each generation
+// the particles are a sample from the posterior at its weight, so one
+// run gives the whole curve of weights on its way (see runTradeoffSMC).
+// The likelihoods are all on the same contexts, which move on between
+// generations as in runTradeoffSweep, so they share one cache.
+// Hyp is as in SpeculativeChain, with the likelihood weight set to 1,
+// so that its likelihood is the communicative accuracy.
+
+// Particles (0 runs MCMC instead).
+// Only change it at startup, like the listener mode.
+size_t smcParticles = 0;
+// MH steps per particle and generation
+size_t smcSteps = 10;
+// Effective sample size kept between generations,
+// as a fraction of the particles
+double smcESS = 0.5;
+
+template <typename Hyp>
+class SMCSampler {
+public:
+
+	using Chain = SpeculativeChain<Hyp>;
+
+	// The particles, which are equally weighted after each generation
+	std::vector<Hyp> particles;
+	// Current likelihood weight
+	double weight = 0;
+	// Estimate of the log normalizing constant at the current weight,
+	// i.e. the log of the mean of exp(weight * commAcc) over the prior
+	double logEvidence = 0;
+	size_t generation = 0;
+	// MH steps taken and accepted in the rejuvenation
+	size_t steps = 0;
+	size_t accepted = 0;
+
+private:
+
+	std::mt19937_64 rng;
+	ContextPool pool;
+	std::vector<PooledContext> contexts;
+	typename Chain::Cache cache;
+
+	// Effective sample size of exp(delta * likelihood)
+	double ess(double delta) const {
+		double top = -infinity;
+		for (auto& p : particles) top = std::max(top, delta * p.likelihood);
+		if (top == -infinity) return 0;
+		double sum = 0, squares = 0;
+		for (auto& p : particles) {
+			double w = std::exp(delta * p.likelihood - top);
+			sum += w;
+			squares += w*w;
+		}
+		return sum*sum / squares;
+	}
+
+	// The likelihoods of all particles on the current contexts,
+	// as one batch. After resampling many particles are copies,
+	// which are only evaluated once
+	void evaluate() {
+		for (auto& p : particles) p.prior = p.compute_prior();
+		std::vector<double> values = cachedLikelihoods(
+			particles, contexts, &cache, FleetArgs::nthreads);
+		for (size_t i = 0; i < particles.size(); i++) {
+			Hyp& p = particles[i];
+			p.likelihood = values[i];
+			p.posterior = p.prior + weight * p.likelihood;
+		}
+	}
+
+	// Systematic resampling with log weights logW
+	void resample(const std::vector<double>& logW) {
+		double top = *std::max_element(logW.begin(), logW.end());
+		std::vector<double> cumulative;
+		double sum = 0;
+		for (double l : logW) {
+			sum += std::exp(l - top);
+			cumulative.push_back(sum);
+		}
+		size_t n = particles.size();
+		double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+		std::vector<Hyp> resampled;
+		size_t j = 0;
+		for (size_t i = 0; i < n; i++) {
+			double target = (i + u) / n * sum;
+			while (j + 1 < n && cumulative[j] < target) j++;
+			resampled.push_back(particles[j]);
+		}
+		particles = std::move(resampled);
+	}
+
+public:
+
+	SMCSampler(size_t n, uint64_t seed, ContextPool p) :
+		rng(seed), pool(std::move(p)), cache(1 << 16) {
+		for (size_t i = 0; i < n; i++) particles.push_back(Hyp::sample());
+		contexts = pool.next();
+		evaluate();
+	}
+
+	bool done(double maxWeight) const { return weight >= maxWeight; }
+
+	// Moves the particles to the next weight, at most maxWeight
+	void step(double maxWeight) {
+		double target = smcESS * particles.size();
+		double next = maxWeight;
+		if (ess(maxWeight - weight) < target) {
+			// the effective sample size goes down with the weight
+			double lo = weight, hi = maxWeight;
+			for (size_t k = 0; k < 50; k++) {
+				double mid = (lo + hi) / 2;
+				(ess(mid - weight) >= target ? lo : hi) = mid;
+			}
+			// always move forward
+			next = std::max(lo, weight + (maxWeight - weight) * 1e-6);
+		}
+
+		// reweight, and add the step to the evidence
+		std::vector<double> logW;
+		for (auto& p : particles) logW.push_back((next - weight) * p.likelihood);
+		double top = *std::max_element(logW.begin(), logW.end());
+		double mean = 0;
+		for (double l : logW) mean += std::exp(l - top);
+		logEvidence += top + std::log(mean / logW.size());
+		weight = next;
+		resample(logW);
+
+		// rejuvenation: likelihood commAcc at temperature 1/weight.
+		// Seeds are drawn in order, so the result does not
+		// depend on the threads
+		std::vector<uint64_t> seeds;
+		for (size_t i = 0; i < particles.size(); i++) seeds.push_back(rng());
+		std::vector<size_t> nAccepted(particles.size());
+		runOnThreads(particles.size(), FleetArgs::nthreads, [&](size_t i) {
+			Chain chain(particles[i], std::max(speculativeWidth, size_t(1)),
+				seeds[i], 1.0 / weight);
+			chain.useContexts(&contexts);
+			chain.useCache(&cache);
+			chain.run(smcSteps, [](const Hyp&) {});
+			particles[i] = chain.state();
+			particles[i].posterior = particles[i].prior + weight * particles[i].likelihood;
+			nAccepted[i] = chain.accepted;
+		});
+		steps += smcSteps * particles.size();
+		for (size_t a : nAccepted) accepted += a;
+
+		// New contexts invalidate the cached likelihoods
+		size_t poolGeneration = pool.generation();
+		contexts = pool.next();
+		if (pool.generation() != poolGeneration) {
+			cache.clear();
+			evaluate();
+		}
+		generation++;
+	}
+};
@@ -0,0 +1,541 @@
+# pragma once
+
+// Speculative Metropolis-Hastings.
+// With few chains and many cores, a chain can only use one core
+// at a time for the likelihood. Instead, each round draws
+// `width` proposals from the current state, evaluates their
+// likelihoods at the same time on the task pool, and then runs
+// the usual accept/reject over them in order. The first accepted
+// proposal becomes the new state and the rest are thrown away,
+// since they were proposed from the old one. Each proposal looked
+// at is one MH step with its own proposal and its own uniform,
+// exactly as in a sequential chain, so the stationary distribution
+// is unchanged: the speculation only wastes the proposals after
+// an acceptance. Since acceptance rates are low in this space,
+// most rounds give `width` steps for the time of one.
+// The proposals thrown away still used up their draws of the
+// generator and of the contexts, so chains of different widths
+// do not follow the same path, only the same distribution.
+// Proposals, contexts and uniforms are all drawn on the chain's
+// thread in order, so the chain does not depend on the threads.
+//
+// Delayed acceptance.
+// Most proposals are rejected, but each one pays for the full
+// likelihood over nObs contexts. With a screen, a step first
+// runs MH on a cheap posterior, whose likelihood is the same
+// computation on a small fixed set of contexts of the chain.
+// Only the proposals that pass it get the full likelihood,
+// and are then accepted with probability
+//   min(1, exp(full(y) - full(x) - (cheap(y) - cheap(x)))),
+// which corrects for the screen, so the posterior is unchanged
+// (Christen & Fox 2005). The screening contexts are fixed for
+// the whole run, so the cheap posterior is a fixed function of
+// the hypothesis, as the correction requires.
+
+// Proposals per round (0 runs ParallelTempering instead).
+// Only change it at startup, like the listener mode.
+size_t speculativeWidth = 0;
+// Contexts in the screen of delayed acceptance (0 is no screen)
+size_t screenSize = 0;
+// Steps that chains run between replica exchanges and checkpoints
+size_t roundSteps = 100;
+
+// The key of h in the cache of likelihoods: its canonical program
+// if it has one (see simplify.h), so that all the ways of writing
+// the same language share an entry, or else its program
+template <typename Hyp>
+std::string likelihoodKey(const Hyp& h) {
+	if constexpr (requires (const Hyp& x) { x.canonicalKey(); }) {
+		return h.canonicalKey();
+	} else {
+		return h.serialize();
+	}
+}
+
+// What the cache of likelihoods keeps of an evaluated hypothesis
+template <typename Data>
+struct CachedLikelihood {
+	double value;
+	Data data;
+	double commAcc;
+	// the program that was evaluated, since other programs
+	// with the same canonical form share the entry
+	std::string serialized;
+};
+
+// Sets h from its entry in the cache, and returns its likelihood.
+// Another program with the same canonical form was never offered
+// to the frontier, and it may be a simpler way of writing the
+// same language, which is the one the frontier should keep
+template <typename Hyp, typename Entry>
+double fromCache(Hyp& h, const Entry& hit) {
+	h.setCommData(hit.data);
+	h.setCommAcc(hit.commAcc);
+	if (hit.serialized != h.serialize()) {
+		paretoFrontier.add(h.prior, h.getCommAcc(), h);
+	}
+	return hit.value;
+}
+
+// The likelihood of h on the contexts cs (with its prior set),
+// from the cache if possible (nullptr is no cache). The cache
+// is keyed by the program (see likelihoodKey), so it is only valid
+// for one set of contexts. Values cut short by breakout are not cached.
+// Every hypothesis evaluated is a candidate for the frontier
+template <typename Hyp, typename Cache>
+double cachedLikelihood(
+		Hyp& h,
+		const std::vector<PooledContext>& cs,
+		Cache* cache,
+		double breakout = -infinity
+	) {
+	if (!cache) {
+		double value = h.likelihoodOn(cs, breakout);
+		paretoFrontier.add(h.prior, h.getCommAcc(), h);
+		return value;
+	}
+	std::string key = likelihoodKey(h);
+	if (auto hit = cache->find(key)) {
+		return fromCache(h, *hit);
+	}
+	double value = h.likelihoodOn(cs, breakout);
+	if (value >= breakout) {
+		cache->insert(key, {value, h.getCommData(), h.getCommAcc(), h.serialize()});
+	}
+	paretoFrontier.add(h.prior, h.getCommAcc(), h);
+	return value;
+}
+
+// Hypotheses evaluated together by cachedLikelihoods
+// (0 is one batch per thread). Larger batches share more,
+// but hold the meanings of all their sentences at once
+size_t evaluationBatch = 64;
+
+// The same for several hypotheses on the same contexts (with their
+// priors set). The ones not in the cache are evaluated in batches
+// (see Agent::evaluateBatch), which nThreads threads take in turns,
+// and copies of a program are only evaluated once.
+// Each hypothesis gets the same value in any batch
+template <typename Hyp, typename Cache>
+std::vector<double> cachedLikelihoods(
+		std::vector<Hyp>& hs,
+		const std::vector<PooledContext>& cs,
+		Cache* cache,
+		size_t nThreads = 1
+	) {
+	std::vector<double> values(hs.size());
+	// the distinct programs to evaluate, and who needs them
+	std::map<std::string, size_t> missIndex;
+	std::vector<Hyp> misses;
+	std::vector<std::vector<size_t>> needed;
+	for (size_t i = 0; i < hs.size(); i++) {
+		if (cache) {
+			if (auto hit = cache->find(likelihoodKey(hs[i]))) {
+				values[i] = fromCache(hs[i], *hit);
+				continue;
+			}
+		}
+		// by the program itself, since the copies get the
+		// evaluated hypothesis, prior included
+		auto [it, added] = missIndex.try_emplace(hs[i].serialize(), misses.size());
+		if (added) {
+			misses.push_back(hs[i]);
+			needed.emplace_back();
+		}
+		needed[it->second].push_back(i);
+	}
+
+	if (misses.empty()) return values;
+
+	nThreads = std::max(nThreads, size_t(1));
+	size_t batchSize = evaluationBatch > 0 ? 
+		evaluationBatch : (misses.size() + nThreads - 1) / nThreads;
+	batchSize = std::max(batchSize, size_t(1));
+	size_t nBatches = (misses.size() + batchSize - 1) / batchSize;
+	std::vector<double> missValues(misses.size());
+	runOnThreads(nBatches, nThreads, [&](size_t t) {
+		size_t begin = t * batchSize;
+		size_t end = std::min(begin + batchSize, misses.size());
+		std::vector<Hyp> batch(misses.begin() + begin, misses.begin() + end);
+		std::vector<double> v = Hyp::likelihoodsOn(batch, cs);
+		for (size_t k = 0; k < batch.size(); k++) {
+			missValues[begin + k] = v[k];
+			misses[begin + k] = std::move(batch[k]);
+		}
+	});
+
+	for (size_t m = 0; m < misses.size(); m++) {
+		if (cache) {
+			cache->insert(likelihoodKey(misses[m]), {
+				missValues[m],
+				misses[m].getCommData(),
+				misses[m].getCommAcc(),
+				misses[m].serialize()
+			});
+		}
+		paretoFrontier.add(misses[m].prior, misses[m].getCommAcc(), misses[m]);
+		for (size_t i : needed[m]) {
+			hs[i] = misses[m];
+			values[i] = missValues[m];
+		}
+	}
+	return values;
+}
+
+// Hyp needs likelihoodOn(contexts, breakout), likelihoodsOn(hyps, contexts),
+// makeContextPool(seed), seedProposals(seed), setCommData(data),
+// setCommAcc(commAcc) and getCommAcc()
+// (see QuantsHypothesis)
+template <typename Hyp>
+class SpeculativeChain {
+public:
+
+	// Likelihoods (and the data behind them) of hypotheses
+	// on one set of contexts, shared by chains that
+	// use the same contexts (see runTradeoffSweep)
+	using Cache = SharedCache<CachedLikelihood<typename Hyp::data_t>>;
+
+private:
+
+	// A proposal and what is known about it
+	struct Candidate {
+		Hyp h;
+		double fb;
+		std::vector<PooledContext> contexts;
+		double screen = -infinity;
+		// the two uniforms of its step
+		double u1;
+		double u2;
+		bool passed = false;
+	};
+
+	Hyp current;
+	// cheap likelihood of the current state
+	double currentScreen = 0;
+	double temperature;
+	size_t width;
+	std::mt19937_64 rng;
+	size_t nScreen;
+	std::vector<PooledContext> screenContexts;
+	// the contexts of the full likelihood come from the chain's
+	// own pool, or are set from outside
+	std::optional<ContextPool> pool;
+	const std::vector<PooledContext>* contexts = nullptr;
+	Cache* cache = nullptr;
+
+	const std::vector<PooledContext>& nextContexts() {
+		if (contexts) return *contexts;
+		if (!pool) pool.emplace(Hyp::makeContextPool(rng()));
+		return pool->next();
+	}
+
+	double likelihood(
+			Hyp& h,
+			const std::vector<PooledContext>& cs,
+			double breakout = -infinity
+		) const {
+		return cachedLikelihood(h, cs, cache, breakout);
+	}
+
+	// Fills in the prior, likelihood and posterior
+	// of h on the given contexts
+	void evaluate(Hyp& h, const std::vector<PooledContext>& cs) const {
+		h.prior = h.compute_prior();
+		h.likelihood = h.prior == -infinity ? -infinity : likelihood(h, cs);
+		h.posterior = h.prior + h.likelihood;
+	}
+
+	double tempered(const Hyp& h) const {
+		return h.prior + h.likelihood / temperature;
+	}
+
+	// Whether two draws of the contexts are the same contexts
+	static bool sameContexts(
+			const std::vector<PooledContext>& a,
+			const std::vector<PooledContext>& b
+		) {
+		return std::equal(a.begin(), a.end(), b.begin(), b.end(),
+			[](auto& x, auto& y) { 
+				return x.seed == y.seed && x.context == y.context; 
+			});
+	}
+
+	static double since(std::chrono::steady_clock::time_point t) {
+		return std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - t).count();
+	}
+
+public:
+
+	// MH steps taken, and accepted
+	size_t steps = 0;
+	size_t accepted = 0;
+	// full likelihoods computed, including the ones thrown away
+	size_t evaluated = 0;
+	// proposals screened, and passed to the full likelihood
+	size_t screened = 0;
+	size_t passed = 0;
+	// seconds spent in the screen and in full likelihoods
+	double screenSeconds = 0;
+	double fullSeconds = 0;
+
+	SpeculativeChain(
+			const Hyp& h0,
+			size_t width,
+			uint64_t seed,
+			double temperature = 1.0,
+			size_t nScreen = 0
+		) : current(h0), temperature(temperature),
+			width(std::max(width, size_t(1))), rng(seed), nScreen(nScreen) {}
+
+	const Hyp& state() const { return current; }
+
+	double getTemperature() const { return temperature; }
+	void setTemperature(double t) { temperature = t; }
+
+	// Take the contexts of the full likelihood from outside
+	// (nullptr goes back to the chain's pool). The caller keeps
+	// them alive and only changes them between calls to run
+	void useContexts(const std::vector<PooledContext>* cs) { contexts = cs; }
+	void useCache(Cache* c) { cache = c; }
+
+	// Recomputes the likelihood of the current state,
+	// e.g. after the contexts set with useContexts change
+	void reevaluate() {
+		if (evaluated > 0) evaluate(current, nextContexts());
+	}
+
+	// Swaps states with another chain (replica exchange)
+	void exchange(SpeculativeChain& other) {
+		std::swap(current, other.current);
+		std::swap(currentScreen, other.currentScreen);
+	}
+
+	// For checkpoints (see checkpoint.h).
+	// The width and screen size come from the options
+	void save(std::ostream& os) const {
+		writeValue(os, current.serialize());
+		writeValue(os, current.prior);
+		writeValue(os, current.likelihood);
+		writeValue(os, current.posterior);
+		auto data = current.getCommData();
+		writeValue(os, uint64_t(data.size()));
+		for (auto& d : data) {
+			writeContext(os, d.input);
+			writeValue(os, d.output);
+		}
+		writeValue(os, currentScreen);
+		writeValue(os, temperature);
+		writeEngine(os, rng);
+		for (size_t x : {steps, accepted, evaluated, screened, passed}) {
+			writeValue(os, uint64_t(x));
+		}
+		writeValue(os, screenSeconds);
+		writeValue(os, fullSeconds);
+		writeValue(os, uint64_t(screenContexts.size()));
+		for (auto& p : screenContexts) {
+			writeContext(os, p.context);
+			writeValue(os, uint64_t(p.seed));
+		}
+		writeValue(os, uint64_t(pool.has_value()));
+		if (pool) pool->save(os);
+	}
+
+	void load(std::istream& is) {
+		current = Hyp(readString(is));
+		current.prior = readDouble(is);
+		current.likelihood = readDouble(is);
+		current.posterior = readDouble(is);
+		typename Hyp::data_t data(readSize(is));
+		for (auto& d : data) {
+			d.input = readContext(is);
+			d.output = readString(is);
+		}
+		current.setCommData(data);
+		currentScreen = readDouble(is);
+		temperature = readDouble(is);
+		readEngine(is, rng);
+		for (size_t* x : {&steps, &accepted, &evaluated, &screened, &passed}) {
+			*x = readSize(is);
+		}
+		screenSeconds = readDouble(is);
+		fullSeconds = readDouble(is);
+		screenContexts.resize(readSize(is));
+		for (auto& p : screenContexts) {
+			t_context c = readContext(is);
+			p = poolContext(c, readSize(is));
+		}
+		pool.reset();
+		if (readSize(is)) {
+			pool.emplace(Hyp::makeContextPool(0));
+			pool->load(is);
+		}
+	}
+
+	// How many times faster than computing the full
+	// likelihood of every proposal, estimated from the
+	// average cost of a full likelihood in this run
+	double throughputGain() const {
+		if (evaluated == 0 || fullSeconds + screenSeconds <= 0) return 1.0;
+		double perFull = fullSeconds / evaluated;
+		size_t proposals = nScreen > 0 ? screened : evaluated;
+		return proposals * perFull / (fullSeconds + screenSeconds);
+	}
+
+	// Runs until nSteps steps in total have been taken,
+	// calling callback on the initial state and on every
+	// state the chain moves to.
+	// Returns early, between two of its rounds, when a signal
+	// asks for a checkpoint (see checkpoint.h). The rounds
+	// only depend on steps and the chain's generator, so
+	// running on to nSteps after a resume takes the same path
+	template <typename Callback>
+	void run(size_t nSteps, Callback callback) {
+		if (steps == 0 && evaluated == 0) {
+			if (nScreen > 0) {
+				// a pool that is never refreshed
+				ContextPool screenPool = Hyp::makeContextPool(rng());
+				screenContexts = screenPool.next();
+				screenContexts.resize(std::min(nScreen, screenContexts.size()));
+				currentScreen = current.likelihoodOn(screenContexts);
+			}
+			evaluate(current, nextContexts());
+			evaluated++;
+			callback(current);
+		}
+		std::uniform_real_distribution<double> uniform(0.0, 1.0);
+		while (steps < nSteps) {
+			if (checkpointRequested()) return;
+			size_t k = std::min(width, nSteps - steps);
+
+			// Proposals, their contexts and uniforms, in order.
+			// A failed proposal is a rejected step
+			std::vector<std::optional<Candidate>> candidates;
+			for (size_t i = 0; i < k; i++) {
+				// from the chain's generator, so that the chain does
+				// not depend on the thread it runs on
+				Hyp::seedProposals(rng());
+				auto p = current.propose();
+				const std::vector<PooledContext>& cs = nextContexts();
+				double u1 = uniform(rng);
+				double u2 = uniform(rng);
+				if (!p) {
+					candidates.emplace_back();
+					continue;
+				}
+				candidates.push_back(Candidate{p->first, p->second, cs});
+				candidates.back()->u1 = u1;
+				candidates.back()->u2 = u2;
+			}
+
+			// First stage: MH on the cheap posterior
+			if (nScreen > 0) {
+				auto start = std::chrono::steady_clock::now();
+				// the screening contexts are the same for all,
+				// so the proposals are one batch
+				std::vector<size_t> index;
+				std::vector<Hyp> batch;
+				for (size_t i = 0; i < k; i++) {
+					if (!candidates[i]) continue;
+					Candidate& c = *candidates[i];
+					c.h.prior = c.h.compute_prior();
+					if (c.h.prior == -infinity) continue;
+					index.push_back(i);
+					batch.push_back(c.h);
+				}
+				std::vector<double> screens = Hyp::likelihoodsOn(batch, screenContexts);
+				for (size_t j = 0; j < index.size(); j++) {
+					candidates[index[j]]->screen = screens[j];
+				}
+				screenSeconds += since(start);
+				for (auto& c : candidates) {
+					if (!c) continue;
+					screened++;
+					double ratio =
+						(c->h.prior + c->screen / temperature)
+						- (current.prior + currentScreen / temperature)
+						- c->fb;
+					c->passed = std::log(c->u1) < ratio;
+					passed += c->passed;
+				}
+			} else {
+				for (auto& c : candidates) if (c) c->passed = true;
+			}
+
+			// Full likelihood of the proposals that passed
+			size_t nFull = 0;
+			for (auto& c : candidates) nFull += c && c->passed;
+			auto start = std::chrono::steady_clock::now();
+			// Proposals on the same contexts are one batch (see
+			// Agent::evaluateBatch). The batch has no breakout,
+			// which only matters with the stopping rule of Hyp
+			std::vector<size_t> index;
+			std::vector<Hyp> batch;
+			bool shared = true;
+			for (size_t i = 0; i < k; i++) {
+				if (!candidates[i] || !candidates[i]->passed) continue;
+				Candidate& c = *candidates[i];
+				c.h.prior = c.h.compute_prior();
+				if (c.h.prior == -infinity) {
+					c.h.likelihood = -infinity;
+					c.h.posterior = -infinity;
+					continue;
+				}
+				if (!batch.empty()) {
+					shared = shared && sameContexts(
+						c.contexts, candidates[index[0]]->contexts);
+				}
+				index.push_back(i);
+				batch.push_back(c.h);
+			}
+			if (batch.size() > 1 && shared) {
+				std::vector<double> values = cachedLikelihoods(
+					batch, candidates[index[0]]->contexts, cache);
+				for (size_t j = 0; j < index.size(); j++) {
+					Candidate& c = *candidates[index[j]];
+					c.h = std::move(batch[j]);
+					c.h.likelihood = values[j];
+					c.h.posterior = c.h.prior + c.h.likelihood;
+				}
+				index.clear();
+			}
+			taskPool.parallelFor(index.size(), [&](size_t j) {
+				size_t i = index[j];
+				Candidate& c = *candidates[i];
+				// The uniform is known, so the likelihood can stop
+				// as soon as it cannot be accepted (see below)
+				double breakout = nScreen > 0 ?
+					current.likelihood + (c.screen - currentScreen) 
+						+ temperature * std::log(c.u2) :
+					temperature * (std::log(c.u2) - c.h.prior 
+						+ tempered(current) + c.fb);
+				c.h.likelihood = likelihood(c.h, c.contexts, breakout);
+				c.h.posterior = c.h.prior + c.h.likelihood;
+			});
+			fullSeconds += since(start);
+			evaluated += nFull;
+
+			// Accept/reject in order, up to the first acceptance
+			for (size_t i = 0; i < k; i++) {
+				steps++;
+				if (!candidates[i] || !candidates[i]->passed) continue;
+				Candidate& c = *candidates[i];
+				// Without a screen this is plain MH. With one,
+				// the cheap posterior and fb were accounted for
+				// by the first stage
+				double ratio = nScreen > 0 ?
+					(c.h.likelihood - current.likelihood
+					 	- (c.screen - currentScreen)) / temperature :
+					tempered(c.h) - tempered(current) - c.fb;
+				// NaN ratios are rejected
+				if (std::log(c.u2) < ratio) {
+					current = std::move(c.h);
+					currentScreen = c.screen;
+					accepted++;
+					callback(current);
+					break;
+				}
+			}
+		}
+	}
+};
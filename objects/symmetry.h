@@ -0,0 +1,119 @@
+# pragma once
+
+// Symmetry reduction of contexts.
+// The lexicon only tells ints apart by their signature
+// (see featureSignature), so two contexts with the same multiset
+// of signatures are the same context as far as any sentence is
+// concerned, whatever the ints are. E.g., {7, -9, 2} and {3, -1, 2}.
+// The canonical form of a context is its sorted signatures,
+// which is used as the key of caches shared by the whole run.
+
+// Key of the multiset of signatures of a context.
+// This is all the listener sees.
+std::string signatureKey(const ObservedContext& oc) {
+	std::vector<t_signature> sigs = oc.signatures;
+	std::sort(sigs.begin(), sigs.end());
+	return std::string(
+		reinterpret_cast<const char*>(sigs.data()),
+		sigs.size()*sizeof(t_signature)
+	);
+}
+
+// Key of the multiset of (signature, target) of a context.
+// This is all the truth of a sentence depends on.
+std::string targetKey(const ObservedContext& oc) {
+	std::vector<uint32_t> entities;
+	for (size_t j = 0; j < oc.size(); j++) {
+		entities.push_back((uint32_t(oc.signatures[j]) << 1) | oc.targets[j]);
+	}
+	std::sort(entities.begin(), entities.end());
+	return std::string(
+		reinterpret_cast<const char*>(entities.data()),
+		entities.size()*sizeof(uint32_t)
+	);
+}
+
+// A thread-safe map shared by all the agents (and chains) of a run.
+// It is simply emptied when it gets too large.
+template <typename Value>
+class SharedCache {
+private:
+
+	std::unordered_map<std::string, Value> entries;
+	mutable std::shared_mutex mutex;
+	size_t maxEntries;
+
+public:
+
+	SharedCache(size_t maxEntries) : maxEntries(maxEntries) {}
+
+	std::optional<Value> find(const std::string& key) const {
+		std::shared_lock lock(mutex);
+		auto it = entries.find(key);
+		if (it == entries.end()) return std::nullopt;
+		return it->second;
+	}
+
+	void insert(const std::string& key, const Value& value) {
+		std::unique_lock lock(mutex);
+		if (entries.size() >= maxEntries) entries.clear();
+		entries.emplace(key, value);
+	}
+
+	size_t size() const {
+		std::shared_lock lock(mutex);
+		return entries.size();
+	}
+
+	void clear() {
+		std::unique_lock lock(mutex);
+		entries.clear();
+	}
+};
+
+// What the listener infers from a meaning in any context
+// with a given multiset of signatures. Entities with the same
+// signature are exchangeable, so they have the same marginal.
+struct CanonicalPosterior {
+	double nTrue;
+	double nVariations;
+	std::map<t_signature, double> marginals;
+
+	CanonicalPosterior(
+			const ListenerPosterior& post,
+			const ObservedContext& oc
+		) : nTrue(post.nTrue), nVariations(post.nVariations) {
+		for (size_t j = 0; j < oc.size(); j++) {
+			marginals[oc.signatures[j]] = post.marginals[j];
+		}
+	}
+
+	// The posterior for a context with the same signatures
+	ListenerPosterior posterior(const ObservedContext& oc) const {
+		ListenerPosterior post;
+		post.nTrue = nTrue;
+		post.nVariations = nVariations;
+		for (t_signature sig : oc.signatures) {
+			post.marginals.push_back(marginals.at(sig));
+		}
+		return post;
+	}
+};
+
+// Exact listener results of compiled meanings,
+// keyed by meaning and signatureKey.
+// Compiled meanings do not depend on the hypothesis
+// they came from, so these hold across hypotheses.
+SharedCache<CanonicalPosterior> listenerCache(1 << 18);
+// Truth of compiled meanings, keyed by meaning and targetKey
+SharedCache<bool> truthCache(1 << 20);
+
+// Truth of a compiled meaning in the observed variation only
+bool observedTruth(const CNode& meaning, const ObservedContext& oc) {
+	IncrementalMeaning evaluator(meaning, oc);
+	for (size_t j = 0; j < oc.size(); j++) {
+		if (oc.targets[j]) evaluator.flip(j, true);
+	}
+	std::optional<bool> v = evaluator.value();
+	return v.has_value() && *v;
+}
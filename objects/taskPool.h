@@ -0,0 +1,291 @@
+# pragma once
+
+// A work-stealing pool of threads shared by the whole run
+// for the work inside the likelihoods, e.g. scoring contexts.
+// ParallelTempering runs one chain per thread, and the cost
+// of a likelihood varies by orders of magnitude between hypotheses
+// (deep cardinality nests vs. constants), so chains with cheap
+// hypotheses sit idle while the slow ones finish.
+// Instead, every chain submits its loops to the pool in chunks,
+// and the workers run the chunks of whoever is busy.
+// A thread waiting for its own loop (a chain, or a worker whose
+// chunk has a nested loop) helps with the chunks of that loop and
+// of the loops nested in it only: a chunk of another chain could
+// take much longer than what is left of its own loop, which would
+// then wait for it.
+//  - Chains push their chunks on a shared queue.
+//  - Workers push the chunks of nested loops on their own deque,
+//    take their own work from the back (newest first, which
+//    keeps nested loops cache-warm and the stack shallow),
+//    and steal from the front of other deques (oldest, i.e. largest,
+//    first) when they run out.
+// The thread that calls parallelFor never blocks while there is
+// work left in its loop that nobody has started, so the pool can be
+// used from any number of chains at once and from inside its own
+// loops without deadlocking.
+// With no workers (the default), parallelFor is a plain loop.
+
+class TaskPool {
+private:
+
+	// A parallel loop
+	struct Job {
+		std::function<void(size_t)> fn;
+		size_t n;
+		// the loop whose iteration started this one, if any.
+		// It waits for this one, so it outlives it
+		const Job* parent;
+		// iterations finished
+		std::atomic<size_t> done{0};
+		// first exception thrown by an iteration
+		std::mutex mutex;
+		std::exception_ptr error;
+
+		Job(const std::function<void(size_t)>& fn, size_t n, const Job* parent) :
+			fn(fn), n(n), parent(parent) {}
+
+		// Whether this is the loop or nested in it
+		bool within(const Job* loop) const {
+			for (const Job* j = this; j != nullptr; j = j->parent) {
+				if (j == loop) return true;
+			}
+			return false;
+		}
+	};
+
+	// A chunk of a loop: iterations [begin, end)
+	struct Task {
+		std::shared_ptr<Job> job;
+		size_t begin;
+		size_t end;
+	};
+
+	// A queue of tasks. Both ends are used, so a
+	// mutex is simpler than a lock-free deque,
+	// and chunks are large enough for it not to matter
+	struct TaskQueue {
+		std::deque<Task> tasks;
+		std::mutex mutex;
+	};
+
+	std::vector<std::thread> workers;
+	// one deque per worker, and the queue of the other threads
+	std::vector<std::unique_ptr<TaskQueue>> deques;
+	TaskQueue shared;
+	// tasks in all the queues
+	std::atomic<size_t> queued{0};
+	// how many times tasks were queued, so that waiting
+	// threads know when to look for their tasks again
+	std::atomic<size_t> pushes{0};
+	// idle threads wait here for tasks (or for their loop to end)
+	std::mutex mutex;
+	std::condition_variable wakeup;
+	bool stopping = false;
+
+	// index of the worker running on this thread in its pool
+	// (a thread is a worker of one pool at most)
+	static inline thread_local const TaskPool* ownerPool = nullptr;
+	static inline thread_local size_t workerIndex = 0;
+	// the loop of the iteration running on this thread
+	static inline thread_local const Job* currentJob = nullptr;
+
+	bool isWorker() const { return ownerPool == this; }
+
+	void notify() {
+		// taking the mutex orders this with the predicate checks
+		{ std::lock_guard lock(mutex); }
+		wakeup.notify_all();
+	}
+
+	void push(std::vector<Task>& tasks) {
+		TaskQueue& q = isWorker() ? *deques[workerIndex] : shared;
+		// counted first, so that the count never goes below zero
+		queued += tasks.size();
+		{
+			std::lock_guard lock(q.mutex);
+			for (auto& t : tasks) q.tasks.push_back(std::move(t));
+		}
+		pushes++;
+		notify();
+	}
+
+	std::optional<Task> popBack(TaskQueue& q) {
+		std::lock_guard lock(q.mutex);
+		if (q.tasks.empty()) return std::nullopt;
+		Task t = std::move(q.tasks.back());
+		q.tasks.pop_back();
+		queued--;
+		return t;
+	}
+
+	std::optional<Task> popFront(TaskQueue& q) {
+		std::lock_guard lock(q.mutex);
+		if (q.tasks.empty()) return std::nullopt;
+		Task t = std::move(q.tasks.front());
+		q.tasks.pop_front();
+		queued--;
+		return t;
+	}
+
+	// The first task of the loop or of a loop nested in it,
+	// from the back or from the front of the queue
+	std::optional<Task> popWithin(TaskQueue& q, const Job* loop, bool back) {
+		std::lock_guard lock(q.mutex);
+		for (size_t k = 0; k < q.tasks.size(); k++) {
+			size_t i = back ? q.tasks.size() - 1 - k : k;
+			if (!q.tasks[i].job->within(loop)) continue;
+			Task t = std::move(q.tasks[i]);
+			q.tasks.erase(q.tasks.begin() + i);
+			queued--;
+			return t;
+		}
+		return std::nullopt;
+	}
+
+	// The next task for this thread: its own deque if it is
+	// a worker, then the shared queue, then the other deques.
+	// A thread waiting for a loop only takes the tasks within it
+	std::optional<Task> findTask(const Job* loop = nullptr) {
+		auto pop = [&](TaskQueue& q, bool back) {
+			if (loop != nullptr) return popWithin(q, loop, back);
+			return back ? popBack(q) : popFront(q);
+		};
+		std::optional<Task> t;
+		size_t first = 0;
+		if (isWorker()) {
+			if ((t = pop(*deques[workerIndex], true))) return t;
+			first = workerIndex + 1;
+		}
+		if ((t = pop(shared, false))) return t;
+		for (size_t k = 0; k < deques.size(); k++) {
+			if ((t = pop(*deques[(first + k) % deques.size()], false))) return t;
+		}
+		return std::nullopt;
+	}
+
+	void run(Task& t) {
+		Job& job = *t.job;
+		const Job* outer = currentJob;
+		currentJob = &job;
+		for (size_t i = t.begin; i < t.end; i++) {
+			try {
+				job.fn(i);
+			} catch (...) {
+				std::lock_guard lock(job.mutex);
+				if (!job.error) job.error = std::current_exception();
+			}
+		}
+		currentJob = outer;
+		if ((job.done += t.end - t.begin) == job.n) notify();
+	}
+
+	void workerLoop(size_t index) {
+		ownerPool = this;
+		workerIndex = index;
+		while (true) {
+			if (std::optional<Task> t = findTask()) {
+				run(*t);
+				continue;
+			}
+			std::unique_lock lock(mutex);
+			wakeup.wait(lock, [this] { return stopping || queued > 0; });
+			if (stopping) return;
+		}
+	}
+
+	void stop() {
+		{
+			std::lock_guard lock(mutex);
+			stopping = true;
+		}
+		wakeup.notify_all();
+		for (auto& w : workers) w.join();
+		workers.clear();
+		deques.clear();
+		stopping = false;
+	}
+
+public:
+
+	TaskPool() = default;
+	TaskPool(const TaskPool&) = delete;
+	TaskPool& operator=(const TaskPool&) = delete;
+
+	~TaskPool() { stop(); }
+
+	// Only call it at startup, when no loop is running
+	void resize(size_t nThreads) {
+		stop();
+		for (size_t i = 0; i < nThreads; i++) {
+			deques.push_back(std::make_unique<TaskQueue>());
+		}
+		for (size_t i = 0; i < nThreads; i++) {
+			workers.emplace_back([this, i] { workerLoop(i); });
+		}
+	}
+
+	size_t size() const { return workers.size(); }
+
+	// Calls fn(i) for every i in [0, n), in any order and
+	// on any thread. Iterations must only write their own outputs,
+	// so the result does not depend on the number of threads.
+	// Rethrows the first exception thrown by an iteration.
+	void parallelFor(size_t n, const std::function<void(size_t)>& fn) {
+		if (workers.empty() || n < 2) {
+			for (size_t i = 0; i < n; i++) fn(i);
+			return;
+		}
+		// a few chunks per thread, so that there is
+		// something left to steal when costs are uneven
+		size_t nChunks = std::min(n, 4*(workers.size() + 1));
+		auto job = std::make_shared<Job>(fn, n, currentJob);
+		std::vector<Task> tasks;
+		for (size_t c = 0; c < nChunks; c++) {
+			tasks.push_back(Task{job, c*n/nChunks, (c + 1)*n/nChunks});
+		}
+		push(tasks);
+		// Work on this loop until it is done, and on the loops
+		// nested in it, whose chunks it is waiting for.
+		// The chunks of other chains are left to the workers
+		while (job->done < n) {
+			size_t seen = pushes;
+			if (std::optional<Task> t = findTask(job.get())) {
+				run(*t);
+				continue;
+			}
+			std::unique_lock lock(mutex);
+			wakeup.wait(lock, [&] { return job->done == n || pushes != seen; });
+		}
+		if (job->error) std::rethrow_exception(job->error);
+	}
+};
+
+// The pool of the run, sized with --likthreads
+TaskPool taskPool;
+
+// Runs fn(i) for every i < n on nThreads threads of their own,
+// which take the indices in turns. This is for loops over
+// independent chains or hypotheses, which play the part of
+// the chains above: the work inside each fn(i) can use the pool.
+// Each fn(i) only writes its own outputs, so the results
+// do not depend on the number of threads.
+void runOnThreads(size_t n, size_t nThreads, const std::function<void(size_t)>& fn) {
+	std::atomic<size_t> next{0};
+	std::vector<std::thread> threads;
+	std::exception_ptr error;
+	std::mutex errorMutex;
+	for (size_t t = 0; t < std::min(std::max(nThreads, size_t(1)), n); t++) {
+		threads.emplace_back([&] {
+			for (size_t i = next++; i < n; i = next++) {
+				try {
+					fn(i);
+				} catch (...) {
+					std::lock_guard lock(errorMutex);
+					if (!error) error = std::current_exception();
+				}
+			}
+		});
+	}
+	for (auto& t : threads) t.join();
+	if (error) std::rethrow_exception(error);
+}
@@ -0,0 +1,133 @@
+# pragma once
+
+// Starting points for the chains from the output of a previous run.
+// Otherwise every chain starts from LangHyp::sample(), and the
+// first steps of a run find again what earlier runs already found,
+// e.g. when sweeping adjacent likelihood weights.
+// It reads the serialized column of either
+//  - a hyp.csv (posterior,prior,likelihood,hypothesis,serialized):
+//    the starts are the best distinct hypotheses by posterior,
+//    as computed by that run;
+//  - a frontier.csv (prior,commacc,hypothesis,serialized, see pareto.h):
+//    the starts are the frontier points that are best at the weight
+//    of the new run, i.e. with the highest prior + weight*commAcc,
+//    which are the ones the previous run found around that weight.
+
+class WarmStart {
+private:
+
+	struct Entry {
+		double posterior;
+		double prior;
+		double commAcc;
+		std::string serialized;
+	};
+
+	std::vector<Entry> entries;
+	bool frontier = false;
+
+	// Splits the last two columns, "hypothesis,serialized".
+	// Both can have commas, so the split is the one where
+	// the serialized program gives back the hypothesis
+	template <typename Hyp>
+	static std::optional<std::string> serializedColumn(const std::string& rest) {
+		for (size_t c = rest.find(','); c != std::string::npos;
+				c = rest.find(',', c+1)) {
+			try {
+				Hyp h(rest.substr(c+1));
+				if (h.string() == rest.substr(0, c)) return rest.substr(c+1);
+			} catch (...) {}
+		}
+		return std::nullopt;
+	}
+
+public:
+
+	// Distinct starting points shared out among the chains
+	// (0 is one per chain)
+	size_t top = 0;
+
+	template <typename Hyp>
+	void load(const std::filesystem::path& path) {
+		std::ifstream file(path);
+		if (!file) {
+			throw std::runtime_error("Cannot read warm start " + path.string());
+		}
+		std::string line;
+		std::getline(file, line);
+		frontier = line.rfind("prior,commacc", 0) == 0;
+		size_t nNumbers = frontier ? 2 : 3;
+
+		// the best row of each hypothesis
+		std::map<std::string, Entry> best;
+		size_t skipped = 0;
+		while (std::getline(file, line)) {
+			if (line.empty()) continue;
+			std::vector<double> numbers;
+			size_t pos = 0;
+			for (size_t k = 0; k < nNumbers && pos != std::string::npos; k++) {
+				size_t comma = line.find(',', pos);
+				if (comma == std::string::npos) break;
+				numbers.push_back(std::strtod(line.c_str() + pos, nullptr));
+				pos = comma + 1;
+			}
+			auto serialized = numbers.size() == nNumbers ?
+				serializedColumn<Hyp>(line.substr(pos)) : std::nullopt;
+			if (!serialized) {
+				skipped++;
+				continue;
+			}
+			Entry e = frontier ?
+				Entry{-infinity, numbers[0], numbers[1], *serialized} :
+				Entry{numbers[0], numbers[1], 0, *serialized};
+			auto it = best.find(e.serialized);
+			if (it == best.end() || it->second.posterior < e.posterior) {
+				best[e.serialized] = e;
+			}
+		}
+		entries.clear();
+		for (auto& [s, e] : best) entries.push_back(e);
+		std::cout
+			<< "Warm start: " << entries.size() << " hypotheses from " << path.string();
+		if (skipped > 0) std::cout << " (" << skipped << " unreadable rows)";
+		std::cout << std::endl;
+	}
+
+	bool empty() const { return entries.empty(); }
+
+	// The k best starting points for a run with this likelihood
+	// weight, best first (fewer if there are not enough)
+	template <typename Hyp>
+	std::vector<Hyp> starts(double weight, size_t k) const {
+		auto score = [&](const Entry& e) {
+			double s = frontier ? e.prior + weight * e.commAcc : e.posterior;
+			return std::isnan(s) ? -infinity : s;
+		};
+		std::vector<const Entry*> sorted;
+		for (auto& e : entries) sorted.push_back(&e);
+		// ties broken by the program, so that it does not depend
+		// on the order of the file
+		std::sort(sorted.begin(), sorted.end(), [&](auto a, auto b) {
+			double sa = score(*a), sb = score(*b);
+			if (sa != sb) return sa > sb;
+			return a->serialized < b->serialized;
+		});
+		std::vector<Hyp> hs;
+		for (size_t i = 0; i < std::min(k, sorted.size()); i++) {
+			hs.emplace_back(sorted[i]->serialized);
+		}
+		return hs;
+	}
+
+	// The starting point of chain c out of n (chain 0 gets the best),
+	// or a sample from the prior without a warm start
+	template <typename Hyp>
+	Hyp start(double weight, size_t c, size_t n) const {
+		if (empty()) return Hyp::sample();
+		auto hs = starts<Hyp>(weight, std::max(top > 0 ? top : n, size_t(1)));
+		return hs[c % hs.size()];
+	}
+};
+
+// Set with --warmstart
+WarmStart warmStart;
@@ -12,9 +12,13 @@ t_context generateContext(
 	){
 
 	t_context context;
-	// pay attention to uniqueness of ints
+	// pay attention to uniqueness of ints.
+	// Ints are in [-10,10], or wider for contexts
+	// too large to have unique ints in that range
+	// (more than 21 elements)
 	std::set<int> ints;
-	t_intdist dist(-10, 10);
+	int maxAbs = std::max(10, (int(size) - 1) / 2 + 1);
+	t_intdist dist(-maxAbs, maxAbs);
 	while (context.size() < size) {
 		// Define the integer component of the element
 		int i = dist(rng);